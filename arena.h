@@ -3,8 +3,11 @@
 
 // @TODO: add way to flag that mem size is free to overwrite.
 #include <stdlib.h>
+#include <string.h>
+#include <assert.h>
 
 #define ARENA_DEFAULT_SIZE 4096
+#define ARENA_DA_INIT_CAP 256
 
 typedef struct ArenaNode {
     struct ArenaNode *next;
@@ -22,6 +25,44 @@ int arena_init(Arena *a, size_t size);
 int arena_deinit(Arena *a);
 int arena_reset(Arena *a);
 char *arena_alloc(Arena *a, size_t size);
+// Grows `old` (old_size bytes from arena_alloc) to new_size. The last
+// allocation grows in place, a block with a node to itself (anything past
+// ARENA_DEFAULT_SIZE) is realloc()ed with its node, anything else is copied
+// and the old block stays in the arena until it is reset.
+char *arena_realloc(Arena *a, void *old, size_t old_size, size_t new_size);
+// Hands every block of `from` over to `a`, which frees them with its own.
+// `from` is left empty, allocation in `a` goes on in its current block.
+void arena_adopt(Arena *a, Arena *from);
+
+// Dynamic arrays ({items, count, capacity}) living in an arena, same
+// growth as nob's da_* macros.
+#define arena_da_reserve(a, da, expected)                                               \
+    do {                                                                                \
+        if ((expected) > (da)->capacity) {                                              \
+            size_t old_cap_ = (da)->capacity;                                           \
+            if ((da)->capacity == 0) (da)->capacity = ARENA_DA_INIT_CAP;                \
+            while ((expected) > (da)->capacity) (da)->capacity *= 2;                    \
+            (da)->items = (void *)arena_realloc((a), (da)->items,                       \
+                                                old_cap_ * sizeof(*(da)->items),        \
+                                                (da)->capacity * sizeof(*(da)->items)); \
+            assert((da)->items != NULL && "Buy more RAM lool!!");                       \
+        }                                                                               \
+    } while (0)
+
+#define arena_da_append(a, da, item)                        \
+    do {                                                    \
+        arena_da_reserve((a), (da), (da)->count + 1);       \
+        (da)->items[(da)->count++] = (item);                \
+    } while (0)
+
+#define arena_da_append_many(a, da, new_items, new_count)                                     \
+    do {                                                                                      \
+        if ((new_count) > 0) {                                                                \
+            arena_da_reserve((a), (da), (da)->count + (new_count));                           \
+            memcpy((da)->items + (da)->count, (new_items), (new_count) * sizeof(*(da)->items)); \
+            (da)->count += (new_count);                                                       \
+        }                                                                                     \
+    } while (0)
 
 #ifdef ARENA_IMPLEMENTATION
 
@@ -38,6 +79,7 @@ int arena_init(Arena *a, size_t size) {
     };
     if (!a->head->data) {
         free(a->head);
+        a->head = NULL; // arena_deinit() must not see it
         return -1;
     }
     a->current = a->head;
@@ -101,5 +143,45 @@ char *arena_alloc(Arena *a, size_t size) {
     return new_node->data;
 }
 
+char *arena_realloc(Arena *a, void *old, size_t old_size, size_t new_size) {
+    if (!old) return arena_alloc(a, new_size);
+    if (new_size <= old_size) return old;
+
+    ArenaNode *node = a->current;
+    size_t old_aligned = (old_size + 7) & ~7;
+    size_t new_aligned = (new_size + 7) & ~7;
+    if ((char *)old + old_aligned == node->data + node->offset &&
+        node->offset - old_aligned + new_aligned <= node->cap) {
+        node->offset += new_aligned - old_aligned;
+        return old;
+    }
+
+    for (ArenaNode *n = a->head; n; n = n->next) {
+        if (n->data != old) continue;
+        if (n->offset != old_aligned) break;
+        size_t cap = new_aligned > n->cap ? new_aligned : n->cap;
+        char *data = (char *)realloc(n->data, cap);
+        if (!data) return NULL;
+        n->data = data;
+        n->cap = cap;
+        n->offset = new_aligned;
+        return data;
+    }
+
+    char *ptr = arena_alloc(a, new_size);
+    if (ptr) memcpy(ptr, old, old_size);
+    return ptr;
+}
+
+void arena_adopt(Arena *a, Arena *from) {
+    if (!from->head) return;
+    ArenaNode *last = from->head;
+    while (last->next) last = last->next;
+    // in front, arena_alloc() links new blocks after the current one
+    last->next = a->head;
+    a->head = from->head;
+    from->head = from->current = NULL;
+}
+
 #endif /* ARENA_IMPLEMENTATION */
 #endif /* ARENA_H */
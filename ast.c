@@ -1,62 +1,251 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include "ast.h"
 #include "lexer.h"
+#include "intern.h"
 
 //@TODO: support the casting keyword on the expr
 
 #define BIGGEST_POWER 40
 
+// Works for both Type* and node handles, AST_NONE and NULL are both 0.
 #define EXPECT_EXIT(p, toktype) \
-    do { if(!expect((p), (toktype))) return NULL; } while(0)
+    do { if(!expect((p), (toktype))) return 0; } while(0)
+
+// A chunk that fails is parsed again by the merge step, which reports the error.
+// A failed lexer already reported its error and ends the stream with a made up
+// T_EOF, what the parser would say about that one is noise.
+#define parse_error(p, loc, fmt, ...) \
+    do { (p)->failed = true; if (!(p)->chunk && !lexer_failed(p)) log_error(loc, fmt, ##__VA_ARGS__); } while (0)
+
+static inline bool lexer_failed(const Parser *p) {
+    return p->lexer != NULL && p->lexer->failed;
+}
+
+// Names the parser makes up itself. They are interned before parsing starts,
+// so chunks parsed on other threads never touch the interner, and again
+// after an intern_deinit() (see intern_generation()).
+static const char *unnamed_param;  // parameters of function types
+static const char *variadic_param; // `...`
+static uint32_t parser_names_generation; // 0 is never current
+
+static void intern_basetype_names(void);
+
+static void intern_parser_names(void) {
+    if (parser_names_generation == intern_generation()) return;
+    unnamed_param = intern_cstr("");
+    variadic_param = intern_cstr("_");
+    intern_basetype_names();
+    parser_names_generation = intern_generation();
+}
+
+static Token *token_at(Parser *p, size_t i) {
+    if (p->tokens) return &p->tokens->items[i];
+
+    Token *slot = &p->window[i & (PARSER_WINDOW - 1)];
+    if (p->packed) {
+        // only tokens the parser looks at get decoded, the slot remembers
+        // which one it holds
+        if (p->decoded[i & (PARSER_WINDOW - 1)] != i + 1) {
+            *slot = packed_get(&p->reader, i);
+            p->decoded[i & (PARSER_WINDOW - 1)] = i + 1;
+        }
+        return slot;
+    }
+
+    while (p->pulled <= i) {
+        p->window[p->pulled & (PARSER_WINDOW - 1)] = lexer_next(p->lexer);
+        p->pulled++;
+    }
+    return slot;
+}
+
+// Kind of the current token. The packed stream answers this from its kind
+// array without decoding the token.
+static TokenKind peek_kind(Parser *p) {
+    if (p->packed) {
+        size_t i = p->current < p->packed->count ? p->current : p->packed->count - 1;
+        return p->packed->kinds[i] & ~PACKED_ESCAPED;
+    }
+    return token_at(p, p->current)->tk;
+}
 
 static Token *peek(Parser *p) {
-    return &p->tokens->items[p->current];
+    return token_at(p, p->current);
 }
 
 static Token *previous(Parser *p) {
-    return &p->tokens->items[p->current - 1];
+    return token_at(p, p->current - 1);
 }
 
 static bool is_at_end(Parser *p) {
-    return peek(p)->tk == T_EOF;
+    return peek_kind(p) == T_EOF;
 }
 
-static Token *advance(Parser *p) {
+// advance() without looking at the token, which the packed stream then
+// never has to decode
+static void skip(Parser *p) {
     if (!is_at_end(p)) p->current++;
+}
+
+static Token *advance(Parser *p) {
+    skip(p);
     return previous(p);
 }
 
 static bool check(Parser *p, TokenKind kind) {
-    if (is_at_end(p)) return false;
-    return peek(p)->tk == kind;
+    TokenKind tk = peek_kind(p);
+    return tk != T_EOF && tk == kind;
 }
 
 static bool match(Parser *p, TokenKind kind) {
     if (check(p, kind)) {
-        advance(p);
+        skip(p);
         return true;
     }
     return false;
 }
 
 static bool expect(Parser *p, TokenKind kind) {
-    Token *cr = peek(p);
     if (!match(p, kind)) {
-        log_error(cr->loc, "Expected token %s, got %s", get_token_str(kind), get_token_str(cr->tk));
+        Token *cr = peek(p);
+        parse_error(p, cr->loc, "Expected token %s, got %s", get_token_str(kind), get_token_str(cr->tk));
         return false;
     }
     return true;
 }
 
-Expr *make_expr(ExprType type, Arena *a) {
-    Expr *n = (Expr *)arena_alloc(a, sizeof(Expr));
-    n->type = type;
-    return n;
+// Copies the literal into the arena so the AST gets a NUL terminated string.
+static char *token_cstr(Parser *p, Token *tok) {
+    String_View sv = p->tokens ? token_text(p->tokens, tok)
+                   : p->lexer  ? lexer_token_text(p->lexer, tok)
+                   :             packed_token_text(p->packed, tok);
+    char *s = arena_alloc(p->arena, sv.count + 1);
+    memcpy(s, sv.data, sv.count);
+    s[sv.count] = '\0';
+    return s;
+}
+
+// ---------------------------------------------------------------------------
+// Node arrays
+// ---------------------------------------------------------------------------
+
+// Grows a node array and its location side table together.
+#define ast_nodes_reserve(a, nodes, expected)                                                    \
+    do {                                                                                         \
+        if ((expected) > (nodes)->capacity) {                                                    \
+            assert((expected) <= UINT32_MAX && "more nodes than 32-bit handles can address");    \
+            size_t old_cap_ = (nodes)->capacity;                                                 \
+            if ((nodes)->capacity == 0) (nodes)->capacity = ARENA_DA_INIT_CAP;                   \
+            while ((expected) > (nodes)->capacity) (nodes)->capacity *= 2;                       \
+            (nodes)->items = (void *)arena_realloc((a), (nodes)->items,                          \
+                                                   old_cap_ * sizeof(*(nodes)->items),           \
+                                                   (nodes)->capacity * sizeof(*(nodes)->items)); \
+            (nodes)->locs = (SrcLoc *)arena_realloc((a), (nodes)->locs,                          \
+                                                    old_cap_ * sizeof(SrcLoc),                   \
+                                                    (nodes)->capacity * sizeof(SrcLoc));         \
+            assert((nodes)->items && (nodes)->locs && "Buy more RAM lool!!");                    \
+        }                                                                                        \
+    } while (0)
+
+void ast_init(Ast *ast, Arena *a) {
+    *ast = (Ast){ .arena = a };
+    // slot 0 of everything is AST_NONE
+    ast_push_expr(ast, (ExprNode){0}, (SrcLoc){0});
+    ast_push_stmt(ast, (StmtNode){0}, (SrcLoc){0});
+    ast_push_name(ast, NULL);
+    ast_push_type(ast, NULL);
+    arena_da_append(a, &ast->extra, 0);
+    arena_da_append(a, &ast->funcs, (AstFunction){0});
+}
+
+ExprId ast_push_expr(Ast *ast, ExprNode node, SrcLoc loc) {
+    ast_nodes_reserve(ast->arena, &ast->exprs, ast->exprs.count + 1);
+    ast->exprs.items[ast->exprs.count] = node;
+    ast->exprs.locs[ast->exprs.count] = loc;
+    return (ExprId)ast->exprs.count++;
+}
+
+StmtId ast_push_stmt(Ast *ast, StmtNode node, SrcLoc loc) {
+    ast_nodes_reserve(ast->arena, &ast->stmts, ast->stmts.count + 1);
+    ast->stmts.items[ast->stmts.count] = node;
+    ast->stmts.locs[ast->stmts.count] = loc;
+    return (StmtId)ast->stmts.count++;
+}
+
+uint32_t ast_push_name(Ast *ast, const char *interned_name) {
+    arena_da_append(ast->arena, &ast->names, interned_name);
+    return (uint32_t)(ast->names.count - 1);
+}
+
+uint32_t ast_push_type(Ast *ast, Type *t) {
+    if (t == NULL && ast->types.count > 0) return AST_NONE;
+    arena_da_append(ast->arena, &ast->types, t);
+    return (uint32_t)(ast->types.count - 1);
+}
+
+uint32_t ast_push_extra(Ast *ast, const uint32_t *items, size_t count) {
+    assert(ast->extra.count + count <= UINT32_MAX && "more nodes than 32-bit handles can address");
+    uint32_t at = (uint32_t)ast->extra.count;
+    arena_da_append_many(ast->arena, &ast->extra, items, count);
+    return at;
+}
+
+// ---------------------------------------------------------------------------
+// List builder
+// ---------------------------------------------------------------------------
+
+// Lists nest (arguments of a call inside arguments of a call), so their
+// children collect on Parser.scratch and a list copies only its own run out
+// when it closes. Nothing is malloc()ed per list and the AST keeps exact
+// sizes.
+static size_t list_open(Parser *p) {
+    return p->scratch.count;
+}
+
+static void list_push(Parser *p, uint32_t item) {
+    arena_da_append(p->arena, &p->scratch, item);
+}
+
+// Pops the run above `base` without keeping it, for parses that failed.
+static void list_discard(Parser *p, size_t base) {
+    p->scratch.count = base;
 }
 
-Stmt *make_stmt(StmtType type, Arena *a) {
-    Stmt *n = (Stmt *)arena_alloc(a, sizeof(Stmt));
-    n->type = type;
-    return n;
+// Moves the run above `base` to Ast.extra, after the number of items in it,
+// each item being `arity` handles. Returns where the count went.
+static uint32_t list_close(Parser *p, size_t base, size_t arity) {
+    size_t len = p->scratch.count - base;
+    uint32_t count = (uint32_t)(len / arity);
+    uint32_t at = ast_push_extra(p->ast, &count, 1);
+    ast_push_extra(p->ast, p->scratch.items + base, len);
+    p->scratch.count = base;
+    return at;
+}
+
+static size_t params_open(Parser *p) {
+    return p->params.count;
+}
+
+static void params_push(Parser *p, Param param) {
+    arena_da_append(p->arena, &p->params, param);
+}
+
+static void params_discard(Parser *p, size_t base) {
+    p->params.count = base;
+}
+
+static Params params_close(Parser *p, size_t base) {
+    Params params = {0};
+    params.count = params.capacity = p->params.count - base;
+    if (params.count > 0) {
+        params.items = (Param *)arena_alloc(p->arena, params.count * sizeof(Param));
+        assert(params.items != NULL && "Buy more RAM lool!!");
+        memcpy(params.items, p->params.items + base, params.count * sizeof(Param));
+    }
+    p->params.count = base;
+    return params;
 }
 
 static int infix_binding_power(TokenKind tk, int *left_bp, int *right_bp) {
@@ -148,490 +337,666 @@ static int infix_binding_power(TokenKind tk, int *left_bp, int *right_bp) {
 
 // THIS IS DUMB
 static Type *parse_type(Parser *p);
-static void print_type(Type *t, int indent);
+static void print_type(const Ast *ast, Type *t, int indent);
+
+static ExprId parse_expression(Parser *p, int min_bp);
+static StmtId parse_statement(Parser *p);
+static StmtId parse_return(Parser *p, Token *kw);
+static StmtId parse_let(Parser *p, Token *kw);
+static StmtId parse_block(Parser *p, Token *kw);
+static StmtId parse_if(Parser *p, Token *kw);
+static StmtId parse_for(Parser *p, Token *kw);
+static StmtId parse_enum(Parser *p, Token *name_tok);
+static StmtId parse_const(Parser *p, Token *name_tok);
+static StmtId parse_struct(Parser *p, Token *name_tok);
+static StmtId parse_defer(Parser *p, Token *name_tok);
+
+static ExprId push_expr(Parser *p, ExprNode node, SrcLoc loc) {
+    return ast_push_expr(p->ast, node, loc);
+}
 
-static Stmt *parse_statement(Parser *p);
-static Stmt *parse_return(Parser *p, Token *kw);
-static Stmt *parse_let(Parser *p, Token *kw);
-static Stmt *parse_block(Parser *p, Token *kw);
-static Stmt *parse_if(Parser *p, Token *kw);
-static Stmt *parse_for(Parser *p, Token *kw);
-static Stmt *parse_enum(Parser *p, Token *name_tok);
-static Stmt *parse_const(Parser *p, Token *name_tok);
-static Stmt *parse_struct(Parser *p, Token *name_tok);
-static Stmt *parse_defer(Parser *p, Token *name_tok);
+static StmtId push_stmt(Parser *p, StmtNode node, SrcLoc loc) {
+    return ast_push_stmt(p->ast, node, loc);
+}
 
-static Expr *parse_expression(Parser *p, int min_bp) {
-    Expr *lhs;
+// Expect: { stuff = yes, second = true, }
+static ExprId parse_compound_lit(Parser *p, Token *tok) {
+    size_t targets = list_open(p);
+    while(!check(p, T_CCPARENT)) {
+        if (!check(p, T_IDENT)) break;
+        size_t mark = list_open(p);
+        ExprId target = parse_expression(p, 0);
+        list_discard(p, mark); // what a failed target left open
+        list_push(p, target);
+        if (check(p, T_COMMA)) advance(p);
+        else break;
+    }
+    uint32_t list = list_close(p, targets, 1);
+    EXPECT_EXIT(p, T_CCPARENT);
+    return push_expr(p, (ExprNode){ .type = EXPR_COMPOUND_LIT, .a = list }, tok->loc);
+}
 
-    // Prefix
-    Token *tok = advance(p);
+static ExprId parse_function_lit(Parser *p) {
+    SrcLoc before = peek(p)->loc;
+    EXPECT_EXIT(p, T_OPARENT);
+    size_t params = params_open(p);
+    if (!check(p, T_CPARENT)) {
+        do {
+            if (!check(p, T_IDENT) && !check(p, T_DOTDOTDOT)) {
+                parse_error(p, peek(p)->loc, "Expecting the parameter to be identifier not %s.", get_token_str(peek(p)->tk));
+                params_discard(p, params);
+                return AST_NONE;
+            }
+
+            Token name = *advance(p);
+            Type *param_type = NULL;
+            if (name.tk != T_DOTDOTDOT) {
+                param_type = parse_type(p);
+                if (!param_type) {
+                    params_discard(p, params);
+                    return AST_NONE;
+                }
+            }
+
+            Param param = {0};
+            if (name.tk == T_DOTDOTDOT) {
+                param.name = variadic_param;
+                param.type = make_type(p->arena, TYPE_CVARIADIC);
+                param.type->loc = name.loc;
+                param.type->as.base.kind = TVARIADIC;
+                param.loc = peek(p)->loc;
+            } else {
+                param.name = name.data.Ident;
+                param.type = param_type;
+            }
+            params_push(p, param);
+        } while (match(p, T_COMMA));
+    }
+
+    if (match(p, T_CPARENT) && check(p, T_ARROW)) {
+        skip(p);
+        Type *ret_type = parse_type(p);
+        if (!ret_type || !expect(p, T_OCPARENT)) {
+            params_discard(p, params);
+            return AST_NONE;
+        }
+
+        Token kw = *previous(p);
+        StmtId body = parse_block(p, &kw);
+
+        AstFunction fn = {
+            .ret = ret_type,
+            .params = params_close(p, params),
+            .body = body,
+        };
+        arena_da_append(p->arena, &p->ast->funcs, fn);
+        return push_expr(p, (ExprNode){ .type = EXPR_FUNCTION, .a = (uint32_t)(p->ast->funcs.count - 1) }, before);
+    }
+
+    parse_error(p, peek(p)->loc, "Unexpected token in expression %s expected %s", get_token_str(peek(p)->tk), get_token_str(T_ARROW));
+    params_discard(p, params);
+    return AST_NONE;
+}
+
+// ---------------------------------------------------------------------------
+// Constant folding
+// ---------------------------------------------------------------------------
+
+// An operator whose operands are all literals becomes the literal it
+// evaluates to, with the location of the operator. Integers are 64 bit and
+// wrap around, signed or unsigned as C would type them (see
+// expr_int_unsigned), an unsigned operand makes the operation unsigned and
+// a shift has the type of its left operand. Mixed with a float they turn
+// into a double. Comparisons and logic give 0 or 1 like true and false.
+// What C leaves undefined or rejects (division by zero, INT64_MIN / -1,
+// shifting by 64 or more, bit operators on floats) is not folded, the later
+// phases get the tree.
+typedef struct {
+    bool is_float;
+    bool is_unsigned;
+    uint64_t u; // the bits of the integer either way
+    double f;
+} Constant;
+
+static bool expr_constant(const Ast *ast, ExprId id, Constant *c) {
+    const ExprNode *e = ast_expr(ast, id);
+    switch (e->type) {
+    case EXPR_LITERAL_INT: {
+        *c = (Constant){ .is_unsigned = expr_int_unsigned(e), .u = expr_payload(e) };
+    } return true;
+    case EXPR_LITERAL_FLOAT: {
+        *c = (Constant){ .is_float = true, .f = expr_float(e) };
+    } return true;
+    default:
+        return false;
+    }
+}
 
-    switch (tok->tk) {
+static inline Constant int_constant(bool is_unsigned, uint64_t u) { return (Constant){ .is_unsigned = is_unsigned, .u = u }; }
+static inline Constant bool_constant(bool b) { return (Constant){ .u = b }; }
+static inline Constant float_constant(double f) { return (Constant){ .is_float = true, .f = f }; }
+
+static inline double constant_double(Constant c) {
+    if (c.is_float) return c.f;
+    return c.is_unsigned ? (double)c.u : (double)(int64_t)c.u;
+}
+
+static bool eval_unary(TokenKind op, Constant x, Constant *r) {
+    switch (op) {
+    case T_MIN:     *r = x.is_float ? float_constant(-x.f) : int_constant(x.is_unsigned, 0 - x.u); return true;
+    case T_NOT:     *r = bool_constant(x.is_float ? x.f == 0 : x.u == 0); return true;
+    case T_BIT_NOT: *r = int_constant(x.is_unsigned, ~x.u); return !x.is_float;
+    default:        return false;
+    }
+}
+
+static bool eval_binary(TokenKind op, Constant x, Constant y, Constant *r) {
+    if (x.is_float || y.is_float) {
+        double a = constant_double(x);
+        double b = constant_double(y);
+        switch (op) {
+        case T_PLUS: *r = float_constant(a + b); return true;
+        case T_MIN:  *r = float_constant(a - b); return true;
+        case T_STAR: *r = float_constant(a * b); return true;
+        case T_DIV:  *r = float_constant(a / b); return b != 0;
+        case T_EQ:   *r = bool_constant(a == b); return true;
+        case T_NEQ:  *r = bool_constant(a != b); return true;
+        case T_LT:   *r = bool_constant(a < b);  return true;
+        case T_GT:   *r = bool_constant(a > b);  return true;
+        case T_LTE:  *r = bool_constant(a <= b); return true;
+        case T_GTE:  *r = bool_constant(a >= b); return true;
+        case T_AND:  *r = bool_constant(a != 0 && b != 0); return true;
+        case T_OR:   *r = bool_constant(a != 0 || b != 0); return true;
+        default:     return false;
+        }
+    }
+
+    uint64_t ua = x.u, ub = y.u;
+    int64_t a = (int64_t)ua, b = (int64_t)ub;
+    bool uns = x.is_unsigned || y.is_unsigned;
+    switch (op) {
+    case T_PLUS:    *r = int_constant(uns, ua + ub); return true;
+    case T_MIN:     *r = int_constant(uns, ua - ub); return true;
+    case T_STAR:    *r = int_constant(uns, ua * ub); return true;
+    case T_DIV:
+    case T_MOD: {
+        if (ub == 0 || (!uns && a == INT64_MIN && b == -1)) return false;
+        if (uns) *r = int_constant(uns, op == T_DIV ? ua / ub : ua % ub);
+        else     *r = int_constant(uns, (uint64_t)(op == T_DIV ? a / b : a % b));
+    } return true;
+    case T_LSHIFT:
+    case T_RSHIFT: {
+        if (ub >= 64) return false; // negative counts too
+        if (op == T_LSHIFT)     *r = int_constant(x.is_unsigned, ua << ub);
+        else if (x.is_unsigned) *r = int_constant(true, ua >> ub);
+        else                    *r = int_constant(false, (uint64_t)(a >> ub));
+    } return true;
+    case T_BIT_AND: *r = int_constant(uns, ua & ub); return true;
+    case T_BIT_OR:  *r = int_constant(uns, ua | ub); return true;
+    case T_BIT_XOR: *r = int_constant(uns, ua ^ ub); return true;
+    case T_EQ:      *r = bool_constant(ua == ub); return true;
+    case T_NEQ:     *r = bool_constant(ua != ub); return true;
+    case T_LT:      *r = bool_constant(uns ? ua < ub  : a < b);  return true;
+    case T_GT:      *r = bool_constant(uns ? ua > ub  : a > b);  return true;
+    case T_LTE:     *r = bool_constant(uns ? ua <= ub : a <= b); return true;
+    case T_GTE:     *r = bool_constant(uns ? ua >= ub : a >= b); return true;
+    case T_AND:     *r = bool_constant(ua && ub); return true;
+    case T_OR:      *r = bool_constant(ua || ub); return true;
+    default:        return false;
+    }
+}
+
+// The operands are the last nodes pushed when they are literals (a folded
+// subtree already took the place of its own operands), so the result simply
+// takes their slots.
+static ExprId push_folded(Parser *p, ExprId first, Constant c, SrcLoc loc) {
+    p->ast->exprs.count = first;
+    if (!c.is_float) {
+        ExprNode leaf = expr_leaf(EXPR_LITERAL_INT, c.u);
+        leaf.op = c.is_unsigned ? INT_LIT_UNSIGNED : INT_LIT_SIGNED;
+        return push_expr(p, leaf, loc);
+    }
+    uint64_t bits;
+    memcpy(&bits, &c.f, sizeof(bits));
+    return push_expr(p, expr_leaf(EXPR_LITERAL_FLOAT, bits), loc);
+}
+
+static ExprId push_unary(Parser *p, TokenKind op, ExprId a, SrcLoc loc) {
+    Constant x, r;
+    if (a + 1 == p->ast->exprs.count && expr_constant(p->ast, a, &x) && eval_unary(op, x, &r)) {
+        return push_folded(p, a, r, loc);
+    }
+    return push_expr(p, (ExprNode){ .type = EXPR_UNARY_OP, .op = op, .a = a }, loc);
+}
+
+static ExprId push_binary(Parser *p, TokenKind op, ExprId a, ExprId b, SrcLoc loc) {
+    Constant x, y, r;
+    if (a + 1 == b && b + 1 == p->ast->exprs.count
+        && expr_constant(p->ast, a, &x) && expr_constant(p->ast, b, &y) && eval_binary(op, x, y, &r)) {
+        return push_folded(p, a, r, loc);
+    }
+    return push_expr(p, (ExprNode){ .type = EXPR_BINARY_OP, .op = op, .a = a, .b = b }, loc);
+}
+
+typedef enum {
+    FRAME_PAREN, // ( operand )
+    FRAME_UNARY, // op operand
+    FRAME_ARG,   // lhs(args..., operand
+    FRAME_INDEX, // lhs[operand]
+    FRAME_INFIX, // lhs op operand, assignment too
+} FrameKind;
+
+static void push_frame(Parser *p, ExprFrame frame) {
+    arena_da_append(p->arena, &p->frames, frame);
+}
+
+static ExprId finish_call(Parser *p, ExprId callee, size_t args, SrcLoc loc) {
+    uint32_t list = list_close(p, args, 1);
+    EXPECT_EXIT(p, T_CPARENT);
+    return push_expr(p, (ExprNode){ .type = EXPR_CALL, .a = callee, .b = list }, loc);
+}
+
+// Pratt parser that does not recurse for operands. Where it would call
+// itself, it pushes a frame for what is left to do, parses the operand with
+// the new min_bp and, once the operand has no more infix operators to take,
+// pops the frame and finishes it. Nesting only costs frame memory, only the
+// literals with statements in them (compound, function) still recurse.
+static ExprId parse_expression(Parser *p, int min_bp) {
+    size_t frames = p->frames.count;
+    size_t scratch = list_open(p);
+    ExprId lhs = AST_NONE;
+
+ operand: {
+    Token tok = *advance(p);
+
+    switch (tok.tk) {
 
     case T_NUM: {
-        lhs = make_expr(EXPR_LITERAL_INT, p->arena);
-        lhs->loc = tok->loc;
-        lhs->as.uint_val = tok->data.Uint64;
+        lhs = push_expr(p, expr_leaf(EXPR_LITERAL_INT, tok.data.Uint64), tok.loc);
     } break;
 
     case T_FLO: {
-        lhs = make_expr(EXPR_LITERAL_FLOAT, p->arena);
-        lhs->loc = tok->loc;
-        lhs->as.float_val = tok->data.F64;
+        uint64_t bits;
+        memcpy(&bits, &tok.data.F64, sizeof(bits));
+        lhs = push_expr(p, expr_leaf(EXPR_LITERAL_FLOAT, bits), tok.loc);
     } break;
 
     case T_STR: {
-        lhs = make_expr(EXPR_LITERAL_STRING, p->arena);
-        lhs->loc = tok->loc;
-        lhs->as.identifier = tok->data.String;
+        lhs = push_expr(p, expr_leaf(EXPR_LITERAL_STRING, (uintptr_t)token_cstr(p, &tok)), tok.loc);
     } break;
 
     case T_IDENT: {
-        lhs = make_expr(EXPR_IDENTIFIER, p->arena);
-        lhs->loc = tok->loc;
-        lhs->as.identifier = tok->data.String;
+        lhs = push_expr(p, expr_leaf(EXPR_IDENTIFIER, (uintptr_t)tok.data.Ident), tok.loc);
     } break;
     case T_FALSE: {
-        lhs = make_expr(EXPR_LITERAL_INT, p->arena);
-        lhs->loc = tok->loc;
-        lhs->as.uint_val = 0;
+        lhs = push_expr(p, expr_leaf(EXPR_LITERAL_INT, 0), tok.loc);
     } break;
     case T_TRUE: {
-        lhs = make_expr(EXPR_LITERAL_INT, p->arena);
-        lhs->loc = tok->loc;
-        lhs->as.uint_val = 1;
+        lhs = push_expr(p, expr_leaf(EXPR_LITERAL_INT, 1), tok.loc);
     } break;
 
-    // Expect: { stuff = yes, second = true, }
     case T_OCPARENT: {
-        lhs = make_expr(EXPR_COMPOUND_LIT, p->arena);
-        lhs->loc = tok->loc;
-        while(!check(p, T_CCPARENT)) {
-            if (!check(p, T_IDENT)) break;
-            Expr *target = parse_expression(p, 0);
-            da_append(&lhs->as.compound_literal.target, target);
-            if (check(p, T_COMMA)) advance(p);
-            else break;
-        }
-        EXPECT_EXIT(p, T_CCPARENT);
+        lhs = parse_compound_lit(p, &tok);
+        if (!lhs) goto fail;
     } break;
 
     case T_FN: {
-        Token *before = peek(p);
-        Params params = {0};
-        EXPECT_EXIT(p, T_OPARENT);
-        if (!check(p, T_CPARENT)) {
-            do {
-                if (!check(p, T_IDENT) && !check(p, T_DOTDOTDOT)) {
-                    log_error(peek(p)->loc, "Expecting the parameter to be identifier not %s.", get_token_str(peek(p)->tk));
-                    return NULL;
-                }
-
-                Token *name = advance(p);
-                Type *param_type = NULL;
-                if (name->tk != T_DOTDOTDOT) {
-                    param_type = parse_type(p);
-                    if (!param_type) return NULL;
-                }
-
-                Param param = {0};
-                if (name->tk == T_DOTDOTDOT) {
-                    param.name = "_";
-                    param.type = make_type(p->arena, TYPE_CVARIADIC);
-                    param.type->loc = name->loc;
-                    param.type->as.base.kind = TVARIADIC;
-                    param.loc = peek(p)->loc;
-                } else {
-                    param.name = name->data.String;
-                    param.type = param_type;
-                }
-                da_append(&params, param);
-            } while (match(p, T_COMMA));
-        }
-
-        if (match(p, T_CPARENT) && check(p, T_ARROW)) {
-            advance(p);
-            Type *ret_type = parse_type(p);
-            if (!ret_type) return NULL;
-
-            EXPECT_EXIT(p, T_OCPARENT);
-            Token *kw = previous(p);
-            Stmt *body = parse_block(p, kw);
-
-            lhs = make_expr(EXPR_FUNCTION, p->arena);
-            lhs->as.function.ret = ret_type;
-            lhs->as.function.body = body;
-            lhs->as.function.params = params;
-            lhs->loc = before->loc;
-        } else {
-            log_error(peek(p)->loc, "Unexpected token in expression %s expected %s", get_token_str(peek(p)->tk), get_token_str(T_ARROW));
-            return NULL;
-        }
+        lhs = parse_function_lit(p);
+        if (!lhs) goto fail;
     } break;
 
     case T_OPARENT: {
-        lhs = parse_expression(p, 0);
-        if (!lhs) return NULL;
-        EXPECT_EXIT(p, T_CPARENT);
-    } break;
+        push_frame(p, (ExprFrame){ .kind = FRAME_PAREN, .min_bp = (uint8_t)min_bp });
+        min_bp = 0;
+        goto operand;
+    }
 
     // Unary operators
     case T_MIN:
     case T_NOT:
     case T_BIT_NOT: {
-        Expr *rhs = parse_expression(p, BIGGEST_POWER);
-        if (!rhs) return NULL;
-
-        lhs = make_expr(EXPR_UNARY_OP, p->arena);
-        lhs->loc = tok->loc;
-        lhs->as.unary.op = tok->tk;
-        lhs->as.unary.right = rhs;
-    } break;
+        push_frame(p, (ExprFrame){ .kind = FRAME_UNARY, .op = tok.tk, .min_bp = (uint8_t)min_bp, .loc = tok.loc });
+        min_bp = BIGGEST_POWER;
+        goto operand;
+    }
 
     default: {
-        Token current_token = p->tokens->items[p->current];
-        log_error(current_token.loc, "Unexpected token in expression: %s", get_token_str(current_token.tk));
-        return NULL;
+        Token current_token = *peek(p);
+        parse_error(p, current_token.loc, "Unexpected token in expression: %s", get_token_str(current_token.tk));
+        goto fail;
     } break;
     }
+    }
 
-    // Infix Loop
+ infix:
     while (1) {
-        Token *next = peek(p);
+        Token next = *peek(p);
 
         // ---------- FUNCTION CALL ----------
-        if (next->tk == T_OPARENT) {
-            Token *before = previous(p);
-            advance(p); // consume '('
-
-            Args args = {0};
+        if (next.tk == T_OPARENT) {
+            SrcLoc before = previous(p)->loc;
+            skip(p); // consume '('
 
+            size_t args = list_open(p);
             if (!check(p, T_CPARENT)) {
-                do {
-                    Expr *arg = parse_expression(p, 0);
-                    if (!arg) return NULL;
-                    da_append(&args, arg);
-                } while (match(p, T_COMMA));
+                push_frame(p, (ExprFrame){ .kind = FRAME_ARG, .min_bp = (uint8_t)min_bp, .lhs = lhs, .loc = before, .args = (uint32_t)args });
+                min_bp = 0;
+                goto operand;
             }
 
-            EXPECT_EXIT(p, T_CPARENT);
-
-            Expr *call = make_expr(EXPR_CALL, p->arena);
-            call->as.call.callee = lhs;
-            call->as.call.args = args;
-            call->loc = before->loc;
-
-            lhs = call;
+            lhs = finish_call(p, lhs, args, before);
+            if (!lhs) goto fail;
             continue;
         }
 
         // ---------- INDEXING ----------
-        if (next->tk == T_OSPARENT) {
-            Token *before = next;
-            advance(p); // consume '['
-
-            Expr *index_expr = parse_expression(p, 0);
-            if (!index_expr) return NULL;
-
-            EXPECT_EXIT(p, T_CSPARENT);
-
-            Expr *idx = make_expr(EXPR_INDEX, p->arena);
-            idx->as.index.object = lhs;
-            idx->as.index.index = index_expr;
-            idx->loc = before->loc;
-
-            lhs = idx;
-            continue;
+        if (next.tk == T_OSPARENT) {
+            skip(p); // consume '['
+            push_frame(p, (ExprFrame){ .kind = FRAME_INDEX, .min_bp = (uint8_t)min_bp, .lhs = lhs, .loc = next.loc });
+            min_bp = 0;
+            goto operand;
         }
 
         // ---------- NORMAL INFIX ----------
         int left_bp, right_bp;
-        if (!infix_binding_power(next->tk, &left_bp, &right_bp))
+        if (!infix_binding_power(next.tk, &left_bp, &right_bp))
             break;
 
         if (left_bp < min_bp)
             break;
 
-        TokenKind op = next->tk;
-        advance(p);
+        skip(p);
+        push_frame(p, (ExprFrame){ .kind = FRAME_INFIX, .op = next.tk, .min_bp = (uint8_t)min_bp, .lhs = lhs, .loc = next.loc });
+        min_bp = right_bp;
+        goto operand;
+    }
 
-        Expr *rhs = parse_expression(p, right_bp);
-        if (!rhs) return NULL;
+    // lhs is complete, it is the operand of the innermost frame
+    if (p->frames.count == frames) return lhs;
 
-        if (op == T_EQUAL) {
-            if (lhs->type != EXPR_IDENTIFIER && lhs->type != EXPR_INDEX) {
-                log_error(lhs->loc, "Invalid assignment target.");
-                return NULL;
-            }
+    ExprFrame frame = p->frames.items[--p->frames.count];
+    min_bp = frame.min_bp;
 
-            Expr *assign = make_expr(EXPR_ASSIGN, p->arena);
-            assign->as.assign.target = lhs;
-            assign->as.assign.value = rhs;
-            assign->loc = next->loc;
+    switch (frame.kind) {
+    case FRAME_PAREN: {
+        if (!expect(p, T_CPARENT)) goto fail;
+    } break;
 
-            lhs = assign;
-            continue;
+    case FRAME_UNARY: {
+        lhs = push_unary(p, frame.op, lhs, frame.loc);
+    } break;
+
+    case FRAME_ARG: {
+        list_push(p, lhs);
+        if (match(p, T_COMMA)) {
+            push_frame(p, frame);
+            min_bp = 0;
+            goto operand;
         }
+        lhs = finish_call(p, frame.lhs, frame.args, frame.loc);
+        if (!lhs) goto fail;
+    } break;
 
-        Expr *bin = make_expr(EXPR_BINARY_OP, p->arena);
-        bin->as.binary.op = op;
-        bin->as.binary.left = lhs;
-        bin->as.binary.right = rhs;
-        bin->loc = next->loc;
+    case FRAME_INDEX: {
+        if (!expect(p, T_CSPARENT)) goto fail;
+        lhs = push_expr(p, (ExprNode){ .type = EXPR_INDEX, .a = frame.lhs, .b = lhs }, frame.loc);
+    } break;
 
-        lhs = bin;
+    case FRAME_INFIX: {
+        if (frame.op == T_EQUAL) {
+            uint8_t target = ast_expr(p->ast, frame.lhs)->type;
+            if (target != EXPR_IDENTIFIER && target != EXPR_INDEX) {
+                parse_error(p, ast_expr_loc(p->ast, frame.lhs), "Invalid assignment target.");
+                goto fail;
+            }
+
+            lhs = push_expr(p, (ExprNode){ .type = EXPR_ASSIGN, .a = frame.lhs, .b = lhs }, frame.loc);
+        } else {
+            lhs = push_binary(p, frame.op, frame.lhs, lhs, frame.loc);
+        }
+    } break;
     }
+    goto infix;
 
-    return lhs;
+ fail:
+    // what the failed operands left open
+    p->frames.count = frames;
+    list_discard(p, scratch);
+    return AST_NONE;
 }
 
-static Stmt *parse_if(Parser *p, Token *kw) {
-    Stmt *stmt = make_stmt(STMT_IF, p->arena);
-    stmt->loc = kw->loc;
-
+static StmtId parse_if(Parser *p, Token *kw) {
     EXPECT_EXIT(p, T_OPARENT);
-    stmt->as.if_stmt.condition = parse_expression(p, 0);
-    if (!stmt->as.if_stmt.condition) return NULL;
+    ExprId condition = parse_expression(p, 0);
+    if (!condition) return AST_NONE;
     EXPECT_EXIT(p, T_CPARENT);
 
-    stmt->as.if_stmt.then_b = parse_statement(p);
-    if (!stmt->as.if_stmt.then_b) return NULL;
+    StmtId then_b = parse_statement(p);
+    if (!then_b) return AST_NONE;
 
-    stmt->as.if_stmt.else_b = NULL;
+    StmtId else_b = AST_NONE;
     if (match(p, T_ELSE)) {
-        stmt->as.if_stmt.else_b = parse_statement(p);
-        if (!stmt->as.if_stmt.else_b) return NULL;
+        else_b = parse_statement(p);
+        if (!else_b) return AST_NONE;
     }
 
-    return stmt;
+    return push_stmt(p, (StmtNode){ .type = STMT_IF, .a = condition, .b = then_b, .c = else_b }, kw->loc);
 }
 
-static Stmt *parse_for(Parser *p, Token *kw) {
-    Stmt *stmt = make_stmt(STMT_FOR, p->arena);
-    stmt->loc = kw->loc;
-
+static StmtId parse_for(Parser *p, Token *kw) {
     EXPECT_EXIT(p, T_OPARENT);
 
     // Init (optional)
-    stmt->as.for_stmt.init = NULL;
+    StmtId init = AST_NONE;
     if (!check(p, T_CLOSING)) {
         // Check if it's a let statement
         if (check(p, T_LET)) {
-            Token *let_tok = advance(p);
-            stmt->as.for_stmt.init = parse_let(p, let_tok);
-            if (!stmt->as.for_stmt.init) return NULL;
+            Token let_tok = *advance(p);
+            init = parse_let(p, &let_tok);
+            if (!init) return AST_NONE;
             // parse_let already consumed the semicolon
         } else {
             // It's an expression statement
-            Expr *init_expr = parse_expression(p, 0);
-            if (!init_expr) return NULL;
+            ExprId init_expr = parse_expression(p, 0);
+            if (!init_expr) return AST_NONE;
 
-            Stmt *init_stmt = make_stmt(STMT_EXPR, p->arena);
-            init_stmt->loc = init_expr->loc;
-            init_stmt->as.expr.expr = init_expr;
-            stmt->as.for_stmt.init = init_stmt;
+            init = push_stmt(p, (StmtNode){ .type = STMT_EXPR, .a = init_expr }, ast_expr_loc(p->ast, init_expr));
 
             EXPECT_EXIT(p, T_CLOSING);
         }
     } else {
-        advance(p); // consume ';'
+        skip(p); // consume ';'
     }
 
     // Condition (optional)
-    stmt->as.for_stmt.condition = NULL;
+    ExprId condition = AST_NONE;
     if (!check(p, T_CLOSING)) {
-        stmt->as.for_stmt.condition = parse_expression(p, 0);
-        if (!stmt->as.for_stmt.condition) return NULL;
+        condition = parse_expression(p, 0);
+        if (!condition) return AST_NONE;
     }
     EXPECT_EXIT(p, T_CLOSING);
 
     // Increment (optional)
-    stmt->as.for_stmt.increment = NULL;
+    ExprId increment = AST_NONE;
     if (!check(p, T_CPARENT)) {
-        stmt->as.for_stmt.increment = parse_expression(p, 0);
-        if (!stmt->as.for_stmt.increment) return NULL;
+        increment = parse_expression(p, 0);
+        if (!increment) return AST_NONE;
     }
 
     EXPECT_EXIT(p, T_CPARENT);
 
     // Body
-    stmt->as.for_stmt.body = parse_statement(p);
-    if (!stmt->as.for_stmt.body) return NULL;
+    StmtId body = parse_statement(p);
+    if (!body) return AST_NONE;
 
-    return stmt;
+    uint32_t rest[2] = { increment, body };
+    uint32_t at = ast_push_extra(p->ast, rest, 2);
+    return push_stmt(p, (StmtNode){ .type = STMT_FOR, .a = init, .b = condition, .c = at }, kw->loc);
 }
 
-static Stmt *parse_const(Parser *p, Token *btok) {
-    Token *name = peek(p);
+static StmtId parse_const(Parser *p, Token *btok) {
+    Token name = *peek(p);
     if (!check(p, T_IDENT)) {
-        log_error(name->loc, "const statement expected token %s, but got %s", get_token_str(T_IDENT), get_token_str(name->tk));
-        return NULL;
+        parse_error(p, name.loc, "const statement expected token %s, but got %s", get_token_str(T_IDENT), get_token_str(name.tk));
+        return AST_NONE;
     }
-    advance(p);
+    skip(p);
 
     Type *consttype = NULL;
     if (!check(p, T_EQUAL)) {
         consttype = parse_type(p);
-        if (!consttype) return NULL;
+        if (!consttype) return AST_NONE;
     }
     EXPECT_EXIT(p, T_EQUAL);
 
-    Expr *exp = parse_expression(p, 0);
-    if (!exp) return NULL;
-    Stmt *const_stmt = make_stmt(STMT_CONST, p->arena);
-    const_stmt->loc = btok->loc;
-    const_stmt->as.const_stmt.name = name->data.String;
-    const_stmt->as.const_stmt.value = exp;
-    const_stmt->as.const_stmt.type = consttype ? consttype : NULL;
+    ExprId exp = parse_expression(p, 0);
+    if (!exp) return AST_NONE;
+    StmtId const_stmt = push_stmt(p, (StmtNode){
+        .type = STMT_CONST,
+        .a = ast_push_name(p->ast, name.data.Ident),
+        .b = ast_push_type(p->ast, consttype),
+        .c = exp,
+    }, btok->loc);
 
     EXPECT_EXIT(p, T_CLOSING);
     return const_stmt;
 }
 
 // @NOTE: you cant change the enum type for now because its too painfull later on... but in the future sure!
-static Stmt *parse_enum(Parser *p, Token *btok) {
-    Token *nametk = peek(p);
+static StmtId parse_enum(Parser *p, Token *btok) {
+    Token nametk = *peek(p);
     if (!check(p, T_IDENT)) {
-        log_error(nametk->loc, "enum statement expected token %s, but got %s", get_token_str(T_IDENT), get_token_str(nametk->tk));
-        return NULL;
+        parse_error(p, nametk.loc, "enum statement expected token %s, but got %s", get_token_str(T_IDENT), get_token_str(nametk.tk));
+        return AST_NONE;
     }
-    advance(p);
+    skip(p);
 
     EXPECT_EXIT(p, T_EQUAL);
     EXPECT_EXIT(p, T_OCPARENT);
-    Stmt * stmt = make_stmt(STMT_ENUM_DEF, p->arena);
-    size_t region_size = sizeof(char) * strlen(nametk->data.String);
-    char *region = arena_alloc(p->arena, region_size + 1);
-    strncpy(region, nametk->data.String, region_size);
-    region[region_size] = '\0';
-    stmt->as.enum_def.name = region;
-    stmt->loc = btok->loc;
 
-    while (!check(p, T_CCPARENT)) {
-        Token *variant_tok = peek(p);
-        EXPECT_EXIT(p, T_IDENT);
+    size_t variants = list_open(p);
 
-        EnumVariant variant = {0};
-        variant.name = variant_tok->data.String;
+    while (!check(p, T_CCPARENT)) {
+        Token variant_tok = *peek(p);
+        if (!expect(p, T_IDENT)) goto fail;
 
+        ExprId value = AST_NONE;
         if (check(p, T_EQUAL)) {
-            advance(p);
-            Token *current = peek(p);
-            Expr *value = parse_expression(p, 0);
-            if (!value) return NULL;
-            if (value->type == EXPR_ASSIGN ||
-                value->type == EXPR_FUNCTION ||
-                value->type == EXPR_CALL)
+            skip(p);
+            SrcLoc current = peek(p)->loc;
+            value = parse_expression(p, 0);
+            if (!value) goto fail;
+            uint8_t type = ast_expr(p->ast, value)->type;
+            if (type == EXPR_ASSIGN ||
+                type == EXPR_FUNCTION ||
+                type == EXPR_CALL)
             {
-                log_error(current->loc, "Enum value didnt support assignment, function definition, and function call expression type.");
-                return NULL;
+                parse_error(p, current, "Enum value didnt support assignment, function definition, and function call expression type.");
+                goto fail;
             }
-            variant.value = value;
-        } else {
-            variant.value = NULL;
         }
-        da_append(&stmt->as.enum_def.variants, variant);
+        list_push(p, ast_push_name(p->ast, variant_tok.data.Ident));
+        list_push(p, value);
 
         if (!match(p, T_CLOSING)) {
             break;
         }
     }
 
-    EXPECT_EXIT(p, T_CCPARENT);
-    EXPECT_EXIT(p, T_CLOSING);
+    if (!expect(p, T_CCPARENT) || !expect(p, T_CLOSING)) goto fail;
+
+    uint32_t at = list_close(p, variants, 2);
+    return push_stmt(p, (StmtNode){
+        .type = STMT_ENUM_DEF,
+        .a = ast_push_name(p->ast, nametk.data.Ident),
+        .b = at,
+    }, btok->loc);
 
-    return stmt;
+ fail:
+    list_discard(p, variants);
+    return AST_NONE;
 }
 
-static Stmt *parse_defer(Parser *p, Token *name_tok) {
-    Stmt *stmt = parse_statement(p);
-    if (!stmt) return NULL;
-    if (stmt->type == STMT_DEFER) {
-        log_error(name_tok->loc, "Defering and defer statement is not allowed!");
-        return NULL;
+static StmtId parse_defer(Parser *p, Token *name_tok) {
+    StmtId stmt = parse_statement(p);
+    if (!stmt) return AST_NONE;
+    if (ast_stmt(p->ast, stmt)->type == STMT_DEFER) {
+        parse_error(p, name_tok->loc, "Defering and defer statement is not allowed!");
+        return AST_NONE;
     }
-    Stmt * ret = make_stmt(STMT_DEFER, p->arena);
-    ret->loc = name_tok->loc;
-    ret->as.defer.callback = stmt;
-    return ret;
+    return push_stmt(p, (StmtNode){ .type = STMT_DEFER, .a = stmt }, name_tok->loc);
 }
 
 // @TODO: add support for generics later on!
-static Stmt *parse_struct(Parser *p, Token *kw) {
-    Token *nametk = peek(p);
+static StmtId parse_struct(Parser *p, Token *kw) {
+    Token nametk = *peek(p);
     if (!check(p, T_IDENT)) {
-        log_error(nametk->loc, "struct statement expected token %s, but got %s", get_token_str(T_IDENT), get_token_str(nametk->tk));
-        return NULL;
+        parse_error(p, nametk.loc, "struct statement expected token %s, but got %s", get_token_str(T_IDENT), get_token_str(nametk.tk));
+        return AST_NONE;
     }
-    advance(p);
+    skip(p);
 
     EXPECT_EXIT(p, T_EQUAL);
     EXPECT_EXIT(p, T_OCPARENT);
-    Stmt * stmt = make_stmt(STMT_STRUCT_DEF, p->arena);
-    size_t region_size = sizeof(char) * strlen(nametk->data.String);
-    char *region = arena_alloc(p->arena, region_size + 1);
-    strncpy(region, nametk->data.String, region_size);
-    region[region_size] = '\0';
-    stmt->as.struct_def.name = region;
-    stmt->loc = kw->loc;
+
+    size_t members = list_open(p);
 
     while (!check(p, T_CCPARENT)) {
-        Token *variant_tok = peek(p);
-        EXPECT_EXIT(p, T_IDENT);
+        Token variant_tok = *peek(p);
+        if (!expect(p, T_IDENT)) goto fail;
 
         Type *variant_type = parse_type(p);
-        if (!variant_type) return NULL;
+        if (!variant_type) goto fail;
 
-        Expr *value = NULL;
+        ExprId value = AST_NONE;
         if (check(p, T_EQUAL)) {
-            advance(p);
+            skip(p);
             value = parse_expression(p, 0);
-            if (!value) return NULL;
+            if (!value) goto fail;
         }
 
-        StructureMember member = {
-            .name = variant_tok->data.String,
-            .type = variant_type,
-            .value = value,
-        };
-
-        da_append(&stmt->as.struct_def.members, member);
+        list_push(p, ast_push_name(p->ast, variant_tok.data.Ident));
+        list_push(p, ast_push_type(p->ast, variant_type));
+        list_push(p, value);
 
         if (!match(p, T_CLOSING)) {
             break;
         }
     }
 
-    EXPECT_EXIT(p, T_CCPARENT);
-    EXPECT_EXIT(p, T_CLOSING);
+    if (!expect(p, T_CCPARENT) || !expect(p, T_CLOSING)) goto fail;
 
-    return stmt;
-}
+    uint32_t at = list_close(p, members, 3);
+    return push_stmt(p, (StmtNode){
+        .type = STMT_STRUCT_DEF,
+        .a = ast_push_name(p->ast, nametk.data.Ident),
+        .b = at,
+    }, kw->loc);
 
-static Stmt *parse_return(Parser *p, Token *kw) {
-    Stmt *stmt = make_stmt(STMT_RET, p->arena);
-    stmt->loc = kw->loc;
+ fail:
+    list_discard(p, members);
+    return AST_NONE;
+}
 
+static StmtId parse_return(Parser *p, Token *kw) {
+    ExprId value = AST_NONE;
     if (!check(p, T_CLOSING)) {
-        stmt->as.expr.expr = parse_expression(p, 0);
-        if (!stmt->as.expr.expr) return NULL;
-    } else {
-        stmt->as.expr.expr = NULL;
+        value = parse_expression(p, 0);
+        if (!value) return AST_NONE;
     }
 
     EXPECT_EXIT(p, T_CLOSING);
-    return stmt;
+    return push_stmt(p, (StmtNode){ .type = STMT_RET, .a = value }, kw->loc);
 }
 
-static Stmt *parse_let(Parser *p, Token *kw) {
-    Token *name = peek(p);
+static StmtId parse_let(Parser *p, Token *kw) {
+    Token name = *peek(p);
     EXPECT_EXIT(p, T_IDENT);
 
     Type *lettype = NULL;
     if (!check(p, T_EQUAL)) {
         lettype = parse_type(p);
-        if (!lettype) return NULL;
+        if (!lettype) return AST_NONE;
     }
 
     EXPECT_EXIT(p, T_EQUAL);
@@ -643,184 +1008,184 @@ static Stmt *parse_let(Parser *p, Token *kw) {
         extern_sym = true;
     }
 
-    Expr *value = parse_expression(p, 0);
-    if (!value) return NULL;
+    ExprId value = parse_expression(p, 0);
+    if (!value) return AST_NONE;
 
     EXPECT_EXIT(p, T_CLOSING);
 
-    Stmt *stmt = make_stmt(STMT_LET, p->arena);
-    stmt->loc = kw->loc;
-    stmt->as.let.name = name->data.String;
-    stmt->as.let.type = lettype;
-    stmt->as.let.extern_symbol = extern_sym;
-    stmt->as.let.value = value;
-
-    return stmt;
+    return push_stmt(p, (StmtNode){
+        .type = STMT_LET,
+        .flags = extern_sym ? STMT_FLAG_EXTERN : 0,
+        .a = ast_push_name(p->ast, name.data.Ident),
+        .b = ast_push_type(p->ast, lettype),
+        .c = value,
+    }, kw->loc);
 }
 
-static Stmt *parse_block(Parser *p, Token *kw) {
-    Stmt *block = make_stmt(STMT_BLOCK, p->arena);
-
-    block->as.block.statements.items = NULL;
-    block->as.block.statements.count = 0;
-    block->as.block.statements.capacity = 0;
-
-    block->loc = kw->loc;
+static StmtId parse_block(Parser *p, Token *kw) {
+    size_t statements = list_open(p);
 
     while (!check(p, T_CCPARENT) && !is_at_end(p)) {
-        Stmt *stmt = parse_statement(p);
-        da_append(&block->as.block.statements, stmt);
+        size_t mark = list_open(p), params_mark = params_open(p);
+        StmtId stmt = parse_statement(p);
+        // a failed statement may leave lists open, the block goes on anyway
+        list_discard(p, mark);
+        params_discard(p, params_mark);
+        list_push(p, stmt);
     }
 
+    uint32_t list = list_close(p, statements, 1);
     EXPECT_EXIT(p, T_CCPARENT);
 
-    return block;
+    return push_stmt(p, (StmtNode){ .type = STMT_BLOCK, .a = list }, kw->loc);
 }
 
-static Stmt *parse_statement(Parser *p) {
+static StmtId parse_statement(Parser *p) {
     if (match(p, T_LET)) {
-        Token *kw = previous(p);
-        return parse_let(p, kw);
+        Token kw = *previous(p);
+        return parse_let(p, &kw);
     }
 
     if (match(p, T_RETURN)) {
-        Token *kw = previous(p);
-        return parse_return(p, kw);
+        Token kw = *previous(p);
+        return parse_return(p, &kw);
     }
 
     if (match(p, T_OCPARENT)) {
-        Token *kw = previous(p);
-        return parse_block(p, kw);
+        Token kw = *previous(p);
+        return parse_block(p, &kw);
     }
 
     if (match(p, T_IF)) {
-        Token *kw = previous(p);
-        return parse_if(p, kw);
+        Token kw = *previous(p);
+        return parse_if(p, &kw);
     }
 
     if (match(p, T_FOR)) {
-        Token *kw = previous(p);
-        return parse_for(p, kw);
+        Token kw = *previous(p);
+        return parse_for(p, &kw);
     }
 
     if (match(p, T_CONST)) {
-        Token *kw = previous(p);
-        return parse_const(p, kw);
+        Token kw = *previous(p);
+        return parse_const(p, &kw);
     }
 
     if (match(p, T_ENUM)) {
-        Token *kw = previous(p);
-        return parse_enum(p, kw);
+        Token kw = *previous(p);
+        return parse_enum(p, &kw);
     }
 
     if (match(p, T_TYPE)) {
-        Token *kw = previous(p);
-        return parse_struct(p, kw);
+        Token kw = *previous(p);
+        return parse_struct(p, &kw);
     }
 
     if (match(p, T_DEFER)) {
-        Token *kw = previous(p);
-        return parse_defer(p, kw);
+        Token kw = *previous(p);
+        return parse_defer(p, &kw);
     }
 
-    Expr *expr = parse_expression(p, 0);
-    if (!expr) return NULL;
+    ExprId expr = parse_expression(p, 0);
+    if (!expr) return AST_NONE;
     EXPECT_EXIT(p, T_CLOSING);
 
-    Stmt *stmt = make_stmt(STMT_EXPR, p->arena);
-    stmt->loc = expr->loc;
-    stmt->as.expr.expr = expr;
-    return stmt;
+    return push_stmt(p, (StmtNode){ .type = STMT_EXPR, .a = expr }, ast_expr_loc(p->ast, expr));
 }
 
 static void print_indent(int n) {
     for (int i = 0; i < n; i++) printf("  ");
 }
 
-void print_expr(Expr *e, int indent) {
-    if (!e) return;
+void print_expr(const Ast *ast, ExprId id, int indent) {
+    if (!id) return;
+    const ExprNode *e = ast_expr(ast, id);
 
     print_indent(indent);
 
     switch (e->type) {
-    case EXPR_COMPOUND_LIT:
+    case EXPR_COMPOUND_LIT: {
         printf("COMPOUND LIT {\n");
-        for (size_t i = 0; i < e->as.compound_literal.target.count; i++) {
-            print_expr(e->as.compound_literal.target.items[i], indent + 1);
+        uint32_t *targets = ast_list_items(ast, e->a);
+        for (size_t i = 0; i < ast_list_count(ast, e->a); i++) {
+            print_expr(ast, targets[i], indent + 1);
         }
         print_indent(indent);
         printf("}\n");
-        break;
+    } break;
     case EXPR_LITERAL_INT:
-        printf("INT(%lu)\n", e->as.uint_val);
+        if (expr_int_unsigned(e)) printf("INT(%lu)\n", expr_payload(e));
+        else                      printf("INT(%ld)\n", (int64_t)expr_payload(e));
         break;
 
     case EXPR_LITERAL_FLOAT:
-        printf("FLOAT(%f)\n", e->as.float_val);
+        printf("FLOAT(%f)\n", expr_float(e));
         break;
 
     case EXPR_LITERAL_STRING:
-        printf("STRING(%s)\n", e->as.identifier);
+        printf("STRING(%s)\n", expr_str(e));
         break;
 
     case EXPR_IDENTIFIER:
-        printf("IDENT(%s)\n", e->as.identifier);
+        printf("IDENT(%s)\n", expr_str(e));
         break;
 
     case EXPR_UNARY_OP:
-        printf("UNARY(op=%s)\n", get_token_str(e->as.unary.op));
-        print_expr(e->as.unary.right, indent + 1);
+        printf("UNARY(op=%s)\n", get_token_str(e->op));
+        print_expr(ast, e->a, indent + 1);
         break;
 
     case EXPR_BINARY_OP:
-        printf("BINARY(op=%s)\n", get_token_str(e->as.binary.op));
-        print_expr(e->as.binary.left, indent + 1);
-        print_expr(e->as.binary.right, indent + 1);
+        printf("BINARY(op=%s)\n", get_token_str(e->op));
+        print_expr(ast, e->a, indent + 1);
+        print_expr(ast, e->b, indent + 1);
         break;
 
     case EXPR_ASSIGN:
         printf("ASSIGN\n");
-        print_expr(e->as.assign.target, indent + 1);
-        print_expr(e->as.assign.value, indent + 1);
+        print_expr(ast, e->a, indent + 1);
+        print_expr(ast, e->b, indent + 1);
         break;
 
-    case EXPR_FUNCTION:
+    case EXPR_FUNCTION: {
         printf("FUNCTION\n");
 
-        if (e->as.function.ret) { print_type(e->as.function.ret, indent + 1); }
-        for (size_t i = 0; i < e->as.function.params.count; i++) {
+        const AstFunction *fn = ast_func(ast, e->a);
+        if (fn->ret) { print_type(ast, fn->ret, indent + 1); }
+        for (size_t i = 0; i < fn->params.count; i++) {
             print_indent(indent + 1);
-            Param p = e->as.function.params.items[i];
+            Param p = fn->params.items[i];
             printf("PARAM: %s\n", p.name);
-            if (p.type) { print_type(p.type, indent + 1); }
+            if (p.type) { print_type(ast, p.type, indent + 1); }
         }
-        print_stmt(e->as.function.body, indent + 1);
-        break;
+        print_stmt(ast, fn->body, indent + 1);
+    } break;
 
-    case EXPR_CALL:
+    case EXPR_CALL: {
         printf("CALL\n");
-        print_expr(e->as.call.callee, indent + 1);
-        for (size_t i = 0; i < e->as.call.args.count; i++) {
-            print_expr(e->as.call.args.items[i], indent + 1);
+        print_expr(ast, e->a, indent + 1);
+        uint32_t *args = ast_list_items(ast, e->b);
+        for (size_t i = 0; i < ast_list_count(ast, e->b); i++) {
+            print_expr(ast, args[i], indent + 1);
         }
-        break;
+    } break;
     case EXPR_INDEX:
         printf("INDEXING\n");
-        print_expr(e->as.index.object, indent + 1);
-        print_expr(e->as.index.index, indent + 1);
+        print_expr(ast, e->a, indent + 1);
+        print_expr(ast, e->b, indent + 1);
     break;
     }
 }
 
 static Type *parse_type(Parser *p) {
-    Token *tok = peek(p);
+    Token tok = *peek(p);
 
     if (check(p, T_DOTDOT)) {
-        advance(p);
+        skip(p);
         Type *inner = parse_type(p);
         if (!inner) return NULL;
         if (inner->kind == TYPE_VARIADIC || inner->kind == TYPE_VARIADIC) {
-            log_error(peek(p)->loc, "Variadic type didnt support another variadic as its type.");
+            parse_error(p, peek(p)->loc, "Variadic type didnt support another variadic as its type.");
             return NULL;
         }
         Type *t = make_type(p->arena, TYPE_VARIADIC);
@@ -828,16 +1193,16 @@ static Type *parse_type(Parser *p) {
             fprintf(stderr, "ERROR: I dont think this is possible but please buy more ram.");
             return NULL;
         }
-        t->loc = tok->loc;
+        t->loc = tok.loc;
         t->as.variadic.var_type = inner;
         return t;
     }
 
     // ---------- ARRAY ----------
     if (check(p, T_OSPARENT)) {  // [
-        advance(p);
+        skip(p);
 
-        Expr *count = NULL;
+        ExprId count = AST_NONE;
         if (!check(p, T_CSPARENT)) {
             count = parse_expression(p, 0);
         }
@@ -847,7 +1212,7 @@ static Type *parse_type(Parser *p) {
         if (!element) return NULL;
 
         Type *t = make_type(p->arena, TYPE_ARRAY);
-        t->loc = tok->loc;
+        t->loc = tok.loc;
         t->as.array.element = element;
         t->as.array.size = count;
         return t;
@@ -855,83 +1220,88 @@ static Type *parse_type(Parser *p) {
 
     // ---------- POINTER ----------
     if (check(p, T_STAR)) {  // *
-        advance(p);
+        skip(p);
 
         Type *base = parse_type(p);
         if (!base) return NULL;
 
         Type *t = make_type(p->arena, TYPE_POINTER);
-        t->loc = tok->loc;
+        t->loc = tok.loc;
         t->as.pointer.base = base;
         return t;
     }
 
-    // ---------- NAMED OR FUNCTION ----------
-    if (check(p, T_IDENT)) {
-        tok = peek(p);
-
-        // ---------- FUNCTION TYPE ----------
-        if (strcmp(tok->data.String, FN_STR) == 0) {
-            advance(p); // consume "fn"
-
-            EXPECT_EXIT(p, T_OPARENT); // (
-
-            Type *t = make_type(p->arena, TYPE_FUNCTION);
-            t->loc = tok->loc;
-
-            // Parse Parameter types
-            while (!check(p, T_CPARENT)) {
-                Param param = {
-                    .name = "",
-                    .type = parse_type(p),
-                    .loc = peek(p)->loc,
-                };
-                if (!param.type) return NULL;
+    // ---------- FUNCTION TYPE ----------
+    if (check(p, T_FN)) {
+        skip(p); // consume "fn"
+
+        EXPECT_EXIT(p, T_OPARENT); // (
+
+        Type *t = make_type(p->arena, TYPE_FUNCTION);
+        t->loc = tok.loc;
+
+        // Parse Parameter types
+        size_t params = params_open(p);
+        while (!check(p, T_CPARENT)) {
+            Param param = {
+                .name = unnamed_param,
+                .type = parse_type(p),
+                .loc = peek(p)->loc,
+            };
+            if (!param.type) {
+                params_discard(p, params);
+                return NULL;
+            }
 
-                da_append(&t->as.function.params, param);
+            params_push(p, param);
 
-                if (!check(p, T_COMMA))
-                    break;
+            if (!check(p, T_COMMA))
+                break;
 
-                advance(p); // consume ,
-            }
+            skip(p); // consume ,
+        }
+        t->as.function.params = params_close(p, params);
 
-            EXPECT_EXIT(p, T_CPARENT); // )
+        EXPECT_EXIT(p, T_CPARENT); // )
 
-            // Expect ->
-            EXPECT_EXIT(p, T_ARROW);
+        // Expect ->
+        EXPECT_EXIT(p, T_ARROW);
 
-            // Parse return type
-            Type *ret = parse_type(p);
-            if (!ret) return NULL;
+        // Parse return type
+        Type *ret = parse_type(p);
+        if (!ret) return NULL;
 
-            t->as.function.ret = ret;
+        t->as.function.ret = ret;
 
-            return t;
-        }
+        return t;
+    }
 
-        // ---------- NORMAL NAMED TYPE ----------
-        advance(p);
+    // ---------- NAMED TYPE ----------
+    if (check(p, T_IDENT)) {
+        skip(p);
 
         Type *t = make_type(p->arena, TYPE_BASE);
-        t->loc = tok->loc;
-        t->as.base.kind = str_to_basetypekind(tok->data.String);
-        t->as.base.name = tok->data.String;
+        t->loc = tok.loc;
+        t->as.base.name = tok.data.Ident;
+        t->as.base.kind = str_to_basetypekind(t->as.base.name);
         return t;
     }
 
-    log_error(tok->loc, "Expected type, got %s", get_token_str(tok->tk));
+    parse_error(p, tok.loc, "Expected type, got %s", get_token_str(tok.tk));
     return NULL;
 }
 
 Type *make_type(Arena *a, TypeKind kind) {
     Type *k = (Type *)arena_alloc(a, sizeof(Type));
-    if (k) k->kind = kind;
+    if (k) {
+        memset(k, 0, sizeof(*k));
+        k->kind = kind;
+    }
     else k = NULL;
     return k;
 }
 
-static void print_type(Type *t, int indent) {
+static void print_type(const Ast *ast, Type *t, int indent) {
     if (!t) return;
 
     print_indent(indent);
@@ -947,7 +1317,7 @@ static void print_type(Type *t, int indent) {
     } break;
     case TYPE_VARIADIC:
         printf("VARIADIC\n");
-        print_type(t->as.variadic.var_type, indent + 1);
+        print_type(ast, t->as.variadic.var_type, indent + 1);
         break;
     case TYPE_CVARIADIC: {
         printf("C STYLE VARIADIC\n");
@@ -958,7 +1328,7 @@ static void print_type(Type *t, int indent) {
 
     case TYPE_POINTER:
         printf("POINTER\n");
-        print_type(t->as.pointer.base, indent + 1);
+        print_type(ast, t->as.pointer.base, indent + 1);
         break;
 
     case TYPE_ARRAY:
@@ -966,170 +1336,591 @@ static void print_type(Type *t, int indent) {
         if (t->as.array.size) {
             print_indent(indent);
             printf("SIZE:");
-            print_expr(t->as.array.size, 0);
+            print_expr(ast, t->as.array.size, 0);
         } else printf("\n");
-        print_type(t->as.array.element, indent + 1);
+        print_type(ast, t->as.array.element, indent + 1);
         break;
 
     case TYPE_FUNCTION:
         printf("FUNCTION TYPE\n");
-        print_type(t->as.function.ret, indent + 1);
+        print_type(ast, t->as.function.ret, indent + 1);
         break;
     }
 }
 
-void print_stmt(Stmt *s, int indent) {
+void print_stmt(const Ast *ast, StmtId id, int indent) {
+    if (!id) return;
+    const StmtNode *s = ast_stmt(ast, id);
+
     print_indent(indent);
 
     switch (s->type) {
     case STMT_DEFER:
         printf("DEFER\n");
-        print_stmt(s->as.defer.callback, indent + 1);
+        print_stmt(ast, s->a, indent + 1);
         break;
     case STMT_IF:
         printf("IF\n");
-        print_expr(s->as.if_stmt.condition, indent + 1);
+        print_expr(ast, s->a, indent + 1);
         print_indent(indent);
         printf("THEN\n");
-        print_stmt(s->as.if_stmt.then_b, indent + 1);
-        if (s->as.if_stmt.else_b) {
+        print_stmt(ast, s->b, indent + 1);
+        if (s->c) {
             print_indent(indent);
             printf("ELSE\n");
-            print_stmt(s->as.if_stmt.else_b, indent + 1);
+            print_stmt(ast, s->c, indent + 1);
         }
         break;
 
-    case STMT_FOR:
+    case STMT_FOR: {
         printf("FOR\n");
-        if (s->as.for_stmt.init) {
+        ExprId increment = ast_extra(ast, s->c)[0];
+        StmtId body = ast_extra(ast, s->c)[1];
+        if (s->a) {
             print_indent(indent + 1);
             printf("INIT:\n");
-            print_stmt(s->as.for_stmt.init, indent + 2);
+            print_stmt(ast, s->a, indent + 2);
         }
-        if (s->as.for_stmt.condition) {
+        if (s->b) {
             print_indent(indent + 1);
             printf("COND:\n");
-            print_expr(s->as.for_stmt.condition, indent + 2);
+            print_expr(ast, s->b, indent + 2);
         }
-        if (s->as.for_stmt.increment) {
+        if (increment) {
             print_indent(indent + 1);
             printf("INC:\n");
-            print_expr(s->as.for_stmt.increment, indent + 2);
+            print_expr(ast, increment, indent + 2);
         }
         print_indent(indent + 1);
         printf("BODY:\n");
-        print_stmt(s->as.for_stmt.body, indent + 2);
-        break;
+        print_stmt(ast, body, indent + 2);
+    } break;
 
-    case STMT_ENUM_DEF:
-        printf("ENUM %s\n", s->as.enum_def.name);
-        for (size_t i = 0; i < s->as.enum_def.variants.count; i++) {
+    case STMT_ENUM_DEF: {
+        printf("ENUM %s\n", ast_name(ast, s->a));
+        uint32_t *variants = ast_extra(ast, s->b);
+        for (size_t i = 0; i < variants[0]; i++) {
+            uint32_t *variant = &variants[1 + 2 * i];
             print_indent(indent + 1);
-            printf("VARIANT(%s)\n", s->as.enum_def.variants.items[i].name);
-            if (s->as.enum_def.variants.items[i].value) print_expr(s->as.enum_def.variants.items[i].value, indent + 2);
+            printf("VARIANT(%s)\n", ast_name(ast, variant[0]));
+            if (variant[1]) print_expr(ast, variant[1], indent + 2);
         }
-        break;
+    } break;
 
-    case STMT_STRUCT_DEF:
-        printf("STRUCT %s\n", s->as.struct_def.name);
-        for (size_t i = 0; i < s->as.struct_def.members.count; i++) {
+    case STMT_STRUCT_DEF: {
+        printf("STRUCT %s\n", ast_name(ast, s->a));
+        uint32_t *members = ast_extra(ast, s->b);
+        for (size_t i = 0; i < members[0]; i++) {
+            uint32_t *member = &members[1 + 3 * i];
             print_indent(indent + 1);
             printf("MEMBER: %s\n",
-                   s->as.struct_def.members.items[i].name);
-            if (s->as.struct_def.members.items[i].type) { print_type(s->as.struct_def.members.items[i].type, indent + 1); }
-            if (s->as.struct_def.members.items[i].value) {
+                   ast_name(ast, member[0]));
+            if (member[1]) { print_type(ast, ast_type(ast, member[1]), indent + 1); }
+            if (member[2]) {
                 print_indent(indent + 2);
                 printf("VALUE:");
-                print_expr(s->as.struct_def.members.items[i].value, 0);
+                print_expr(ast, member[2], 0);
             }
         }
-        break;
+    } break;
 
     case STMT_RET:
         printf("RET\n");
-        if (s->as.expr.expr) print_expr(s->as.expr.expr, indent + 1);
+        if (s->a) print_expr(ast, s->a, indent + 1);
         break;
 
     case STMT_LET:
-        printf("LET %s\n", s->as.let.name);
+        printf("LET %s\n", ast_name(ast, s->a));
         print_indent(indent);
-        printf("%s\n", s->as.let.extern_symbol ? "EXTERN" : "IN");
-        if (s->as.let.type) { print_type(s->as.let.type, indent + 1); }
-        print_expr(s->as.let.value, indent + 1);
+        printf("%s\n", s->flags & STMT_FLAG_EXTERN ? "EXTERN" : "IN");
+        if (s->b) { print_type(ast, ast_type(ast, s->b), indent + 1); }
+        print_expr(ast, s->c, indent + 1);
         break;
 
     case STMT_CONST:
-        printf("CONST %s\n", s->as.const_stmt.name);
-        if (s->as.let.type) { print_type(s->as.const_stmt.type, indent + 1); }
-        print_expr(s->as.const_stmt.value, indent + 1);
+        printf("CONST %s\n", ast_name(ast, s->a));
+        if (s->b) { print_type(ast, ast_type(ast, s->b), indent + 1); }
+        print_expr(ast, s->c, indent + 1);
         break;
 
     case STMT_EXPR:
         printf("EXPR_STMT\n");
-        print_expr(s->as.expr.expr, indent + 1);
+        print_expr(ast, s->a, indent + 1);
         break;
 
-    case STMT_BLOCK:
+    case STMT_BLOCK: {
         printf("BLOCK\n");
-        for (size_t i = 0; i < s->as.block.statements.count; i++) {
-            print_stmt(s->as.block.statements.items[i], indent + 1);
+        uint32_t *statements = ast_list_items(ast, s->a);
+        for (size_t i = 0; i < ast_list_count(ast, s->a); i++) {
+            print_stmt(ast, statements[i], indent + 1);
         }
-        break;
+    } break;
     }
 }
 
-bool make_ast(Arena *a, Statements *stmts, Tokens *t) {
+static bool parse_program(Parser *p, Statements *stmts) {
+    while (!is_at_end(p) && !lexer_failed(p)) {
+        StmtId stmt = parse_statement(p);
+        if (stmt == AST_NONE) {
+            return false;
+        }
+        arena_da_append(p->arena, stmts, stmt);
+    }
+    return true;
+}
+
+bool make_ast(Ast *ast, Statements *stmts, Tokens *t) {
+    intern_parser_names();
     Parser p = {0};
     p.tokens = t;
     p.current = 0;
-    p.arena = a;
+    p.ast = ast;
+    p.arena = ast->arena;
+    return parse_program(&p, stmts);
+}
 
-    while (!is_at_end(&p)) {
-        Stmt *stmt = parse_statement(&p);
-        if (stmt == NULL) {
-            return false;
+// Same as make_ast, but tokens are pulled from the lexer while parsing, so no
+// token array is ever built.
+bool make_ast_stream(Ast *ast, Statements *stmts, Lexer *l) {
+    intern_parser_names();
+    Parser p = {0};
+    p.lexer = l;
+    p.current = 0;
+    p.ast = ast;
+    p.arena = ast->arena;
+    return parse_program(&p, stmts) && !l->failed;
+}
+
+bool make_ast_packed(Ast *ast, Statements *stmts, PackedTokens *pt) {
+    intern_parser_names();
+    Parser p = {0};
+    p.packed = pt;
+    packed_reader_init(&p.reader, pt);
+    p.current = 0;
+    p.ast = ast;
+    p.arena = ast->arena;
+    return parse_program(&p, stmts);
+}
+
+// ---------------------------------------------------------------------------
+// Parallel parsing
+// ---------------------------------------------------------------------------
+
+#ifndef PARSE_CHUNK_MIN
+#define PARSE_CHUNK_MIN (16 * 1024) // tokens
+#endif
+
+// Added to the handles of a chunk to get the merged ones.
+typedef struct {
+    uint32_t exprs, stmts, names, types, extra, funcs;
+} AstShift;
+
+// A run of whole top level statements, parsed into an Ast of its own. Within
+// a chunk children come before parents, and chunks are merged in source
+// order, so shifting the handles gives the same Ast make_ast() builds.
+typedef struct {
+    size_t start, end; // token range
+    Arena nodes;       // the Ast arrays, dropped after the merge
+    Arena keep;        // types, literals and parameters, handed over to the Ast arena
+    Ast ast;
+    Statements stmts;
+    AstShift shift;
+    bool failed;
+} ParseChunk;
+
+typedef struct ParseJob ParseJob;
+struct ParseJob {
+    ParseChunk *chunks;
+    size_t count;
+    Tokens *tokens;
+    Ast *ast;
+    void (*run)(ParseJob *job, ParseChunk *c);
+    atomic_size_t next;
+};
+
+// Top level statements end on a `;` outside of any brackets, unless an
+// `else` follows (`if (a) b; else c;`). A chunk ends on the first such `;`
+// once it holds `target` tokens, statements ending on a `}` never end one.
+// A cut that is not a statement boundary after all only makes a chunk fail,
+// and the chunks from there on are parsed again sequentially.
+static size_t parse_chunk_end(const Tokens *t, size_t start, size_t target) {
+    size_t last = t->count - 1; // T_EOF
+    int depth = 0;
+    for (size_t i = start; i < last; i++) {
+        switch (t->items[i].tk) {
+        case T_OPARENT:
+        case T_OSPARENT:
+        case T_OCPARENT:
+            depth++;
+            break;
+        case T_CPARENT:
+        case T_CSPARENT:
+        case T_CCPARENT:
+            depth--;
+            break;
+        case T_CLOSING:
+            if (depth == 0 && i + 1 - start >= target && t->items[i + 1].tk != T_ELSE) return i + 1;
+            break;
+        default:
+            break;
         }
-        da_append(stmts, stmt);
     }
-    return true;
+    return last;
 }
 
-const char *get_basetypekind_str(BaseTypeKind type) {
-    switch (type) {
-        case TS8:       { return "s8";       }
-        case TS16:      { return "s16";      }
-        case TS32:      { return "s32";      }
-        case TS64:      { return "s64";      }
-        case TU8:       { return "u8";       }
-        case TU16:      { return "u16";      }
-        case TU32:      { return "u32";      }
-        case TU64:      { return "u64";      }
-        case TF32:      { return "f32";      }
-        case TF64:      { return "f64";      }
-        case TBOOL:     { return "bool";     }
-        case TCHAR:     { return "char";     }
-        case TANY:      { return "any";      }
-        case TVARIADIC: { return "variadic"; }
-        default: break;
+static void parse_chunk(ParseJob *job, ParseChunk *c) {
+    if (arena_init(&c->nodes, 0) != 0 || arena_init(&c->keep, 0) != 0) {
+        c->failed = true;
+        return;
+    }
+
+    ast_init(&c->ast, &c->nodes);
+    Parser p = {0};
+    p.tokens = job->tokens;
+    p.current = c->start;
+    p.ast = &c->ast;
+    p.arena = &c->keep;
+    p.chunk = true;
+
+    // Same loop as parse_program(), the parser may look past the end of the
+    // chunk like it would in make_ast(), but a statement has to end there.
+    while (p.current < c->end) {
+        StmtId stmt = parse_statement(&p);
+        if (stmt == AST_NONE) break;
+        arena_da_append(p.arena, &c->stmts, stmt);
+    }
+    c->failed = p.current != c->end || p.failed;
+}
+
+#define SHIFT(id, by) ((id) ? (id) + (by) : AST_NONE)
+
+static void shift_type(Type *t, const AstShift *sh) {
+    if (!t) return;
+    switch (t->kind) {
+    case TYPE_POINTER:
+        shift_type(t->as.pointer.base, sh);
+        break;
+    case TYPE_ARRAY:
+        t->as.array.size = SHIFT(t->as.array.size, sh->exprs);
+        shift_type(t->as.array.element, sh);
+        break;
+    case TYPE_FUNCTION:
+        shift_type(t->as.function.ret, sh);
+        for (size_t i = 0; i < t->as.function.params.count; i++) {
+            shift_type(t->as.function.params.items[i].type, sh);
+        }
+        break;
+    case TYPE_VARIADIC:
+        shift_type(t->as.variadic.var_type, sh);
+        break;
+    case TYPE_ENUM:
+        t->as.enum_type.def = SHIFT(t->as.enum_type.def, sh->stmts);
+        break;
+    case TYPE_STRUCT:
+        t->as.struct_type.def = SHIFT(t->as.struct_type.def, sh->stmts);
+        break;
+    case TYPE_BASE:
+    case TYPE_CVARIADIC:
+        break;
+    }
+}
+
+static void shift_list(Ast *ast, uint32_t list, uint32_t by) {
+    uint32_t *items = ast_list_items(ast, list);
+    for (uint32_t i = 0; i < ast_list_count(ast, list); i++) items[i] = SHIFT(items[i], by);
+}
+
+// Copies the nodes of a chunk to their place in the Ast and shifts the
+// handles in them. Every list in Ast.extra belongs to one node and gets
+// shifted along with it. Types are shifted in place, the chunk arena they
+// live in is handed over to the Ast later.
+static void merge_chunk(ParseJob *job, ParseChunk *c) {
+    Ast *ast = job->ast;
+    const Ast *from = &c->ast;
+    const AstShift *sh = &c->shift;
+
+    // slot 0 is AST_NONE in both
+    memcpy(ast->names.items + sh->names + 1, from->names.items + 1, (from->names.count - 1) * sizeof(*from->names.items));
+    memcpy(ast->types.items + sh->types + 1, from->types.items + 1, (from->types.count - 1) * sizeof(*from->types.items));
+    memcpy(ast->extra.items + sh->extra + 1, from->extra.items + 1, (from->extra.count - 1) * sizeof(*from->extra.items));
+    memcpy(ast->exprs.locs + sh->exprs + 1, from->exprs.locs + 1, (from->exprs.count - 1) * sizeof(SrcLoc));
+    memcpy(ast->stmts.locs + sh->stmts + 1, from->stmts.locs + 1, (from->stmts.count - 1) * sizeof(SrcLoc));
+
+    for (size_t i = 1; i < from->types.count; i++) shift_type(from->types.items[i], sh);
+
+    for (size_t i = 1; i < from->exprs.count; i++) {
+        ExprNode e = from->exprs.items[i];
+        switch (e.type) {
+        case EXPR_LITERAL_INT:
+        case EXPR_LITERAL_FLOAT:
+        case EXPR_LITERAL_STRING:
+        case EXPR_IDENTIFIER:
+            break;
+        case EXPR_UNARY_OP:
+            e.a = SHIFT(e.a, sh->exprs);
+            break;
+        case EXPR_BINARY_OP:
+        case EXPR_ASSIGN:
+        case EXPR_INDEX:
+            e.a = SHIFT(e.a, sh->exprs);
+            e.b = SHIFT(e.b, sh->exprs);
+            break;
+        case EXPR_CALL:
+            e.a = SHIFT(e.a, sh->exprs);
+            e.b += sh->extra;
+            shift_list(ast, e.b, sh->exprs);
+            break;
+        case EXPR_COMPOUND_LIT:
+            e.a += sh->extra;
+            shift_list(ast, e.a, sh->exprs);
+            break;
+        case EXPR_FUNCTION:
+            e.a += sh->funcs;
+            break;
+        }
+        ast->exprs.items[i + sh->exprs] = e;
+    }
+
+    for (size_t i = 1; i < from->stmts.count; i++) {
+        StmtNode s = from->stmts.items[i];
+        switch (s.type) {
+        case STMT_EXPR:
+        case STMT_RET:
+            s.a = SHIFT(s.a, sh->exprs);
+            break;
+        case STMT_LET:
+        case STMT_CONST:
+            s.a += sh->names;
+            s.b = SHIFT(s.b, sh->types);
+            s.c = SHIFT(s.c, sh->exprs);
+            break;
+        case STMT_IF:
+            s.a = SHIFT(s.a, sh->exprs);
+            s.b = SHIFT(s.b, sh->stmts);
+            s.c = SHIFT(s.c, sh->stmts);
+            break;
+        case STMT_FOR: {
+            s.a = SHIFT(s.a, sh->stmts);
+            s.b = SHIFT(s.b, sh->exprs);
+            s.c += sh->extra;
+            uint32_t *rest = ast_extra(ast, s.c);
+            rest[0] = SHIFT(rest[0], sh->exprs);
+            rest[1] = SHIFT(rest[1], sh->stmts);
+        } break;
+        case STMT_BLOCK:
+            s.a += sh->extra;
+            shift_list(ast, s.a, sh->stmts);
+            break;
+        case STMT_DEFER:
+            s.a = SHIFT(s.a, sh->stmts);
+            break;
+        case STMT_ENUM_DEF: {
+            s.a += sh->names;
+            s.b += sh->extra;
+            uint32_t *variants = ast_extra(ast, s.b);
+            for (uint32_t j = 0; j < variants[0]; j++) {
+                uint32_t *variant = &variants[1 + 2 * j];
+                variant[0] += sh->names;
+                variant[1] = SHIFT(variant[1], sh->exprs);
+            }
+        } break;
+        case STMT_STRUCT_DEF: {
+            s.a += sh->names;
+            s.b += sh->extra;
+            uint32_t *members = ast_extra(ast, s.b);
+            for (uint32_t j = 0; j < members[0]; j++) {
+                uint32_t *member = &members[1 + 3 * j];
+                member[0] += sh->names;
+                member[1] = SHIFT(member[1], sh->types);
+                member[2] = SHIFT(member[2], sh->exprs);
+            }
+        } break;
+        }
+        ast->stmts.items[i + sh->stmts] = s;
+    }
+
+    for (size_t i = 1; i < from->funcs.count; i++) {
+        AstFunction fn = from->funcs.items[i];
+        fn.body = SHIFT(fn.body, sh->stmts);
+        shift_type(fn.ret, sh);
+        for (size_t j = 0; j < fn.params.count; j++) shift_type(fn.params.items[j].type, sh);
+        ast->funcs.items[i + sh->funcs] = fn;
+    }
+}
+
+static void *parse_worker(void *arg) {
+    ParseJob *job = arg;
+    while (true) {
+        size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->count) break;
+        job->run(job, &job->chunks[i]);
     }
     return NULL;
 }
 
-BaseTypeKind str_to_basetypekind(const char *name) {
-    if      (strcmp(name, "s8")       == 0) { return TS8;       }
-    else if (strcmp(name, "s16")      == 0) { return TS16;      }
-    else if (strcmp(name, "s32")      == 0) { return TS32;      }
-    else if (strcmp(name, "s64")      == 0) { return TS64;      }
-    else if (strcmp(name, "u8")       == 0) { return TU8;       }
-    else if (strcmp(name, "u16")      == 0) { return TU16;      }
-    else if (strcmp(name, "u32")      == 0) { return TU32;      }
-    else if (strcmp(name, "u64")      == 0) { return TU64;      }
-    else if (strcmp(name, "f32")      == 0) { return TF32;      }
-    else if (strcmp(name, "f64")      == 0) { return TF64;      }
-    else if (strcmp(name, "bool")     == 0) { return TBOOL;     }
-    else if (strcmp(name, "char")     == 0) { return TCHAR;     }
-    else if (strcmp(name, "any")      == 0) { return TANY;      }
-    else if (strcmp(name, "variadic") == 0) { return TVARIADIC; }
+// Runs job->run on every chunk, on `threads` threads counting the caller.
+static void parse_pool(ParseJob *job, size_t threads) {
+    atomic_store(&job->next, 0);
+    if (threads > job->count) threads = job->count;
+
+    pthread_t *pool = malloc(sizeof(*pool) * threads);
+    size_t started = 0;
+    for (size_t i = 1; i < threads; i++) {
+        if (pthread_create(&pool[started], NULL, parse_worker, job) != 0) break;
+        started++;
+    }
+    parse_worker(job);
+    for (size_t i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    free(pool);
+}
+
+bool make_ast_parallel(Ast *ast, Statements *stmts, Tokens *t, size_t threads) {
+    if (threads == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (size_t)n : 1;
+    }
+
+    // a few chunks per thread so one slow chunk does not stall the rest
+    size_t target = t->count / (threads * 4);
+    if (target < PARSE_CHUNK_MIN) target = PARSE_CHUNK_MIN;
+
+    struct {
+        ParseChunk *items;
+        size_t count;
+        size_t capacity;
+    } chunks = {0};
+
+    for (size_t start = 0; start + 1 < t->count;) {
+        size_t end = parse_chunk_end(t, start, target);
+        ParseChunk c = { .start = start, .end = end };
+        da_append(&chunks, c);
+        start = end;
+    }
+
+    if (threads == 1 || chunks.count <= 1) {
+        da_free(chunks);
+        return make_ast(ast, stmts, t);
+    }
+
+    intern_parser_names();
+    ParseJob job = {
+        .chunks = chunks.items,
+        .count  = chunks.count,
+        .tokens = t,
+        .ast    = ast,
+        .run    = parse_chunk,
+    };
+    parse_pool(&job, threads);
+
+    // Chunks up to the first failed one go where a sequential parse would
+    // have put their nodes.
+    size_t merged = 0;
+    size_t exprs = ast->exprs.count, nodes = ast->stmts.count, names = ast->names.count;
+    size_t types = ast->types.count, extra = ast->extra.count, funcs = ast->funcs.count;
+    for (; merged < chunks.count && !chunks.items[merged].failed; merged++) {
+        ParseChunk *c = &chunks.items[merged];
+        c->shift = (AstShift){
+            .exprs = (uint32_t)(exprs - 1),
+            .stmts = (uint32_t)(nodes - 1),
+            .names = (uint32_t)(names - 1),
+            .types = (uint32_t)(types - 1),
+            .extra = (uint32_t)(extra - 1),
+            .funcs = (uint32_t)(funcs - 1),
+        };
+        exprs += c->ast.exprs.count - 1;
+        nodes += c->ast.stmts.count - 1;
+        names += c->ast.names.count - 1;
+        types += c->ast.types.count - 1;
+        extra += c->ast.extra.count - 1;
+        funcs += c->ast.funcs.count - 1;
+    }
+    assert(names <= UINT32_MAX && types <= UINT32_MAX && extra <= UINT32_MAX && funcs <= UINT32_MAX
+           && "more nodes than 32-bit handles can address");
+
+    ast_nodes_reserve(ast->arena, &ast->exprs, exprs);
+    ast_nodes_reserve(ast->arena, &ast->stmts, nodes);
+    arena_da_reserve(ast->arena, &ast->names, names);
+    arena_da_reserve(ast->arena, &ast->types, types);
+    arena_da_reserve(ast->arena, &ast->extra, extra);
+    arena_da_reserve(ast->arena, &ast->funcs, funcs);
+    if (merged > 0) {
+        job.count = merged;
+        job.run = merge_chunk;
+        parse_pool(&job, threads);
+    }
+    ast->exprs.count = exprs;
+    ast->stmts.count = nodes;
+    ast->names.count = names;
+    ast->types.count = types;
+    ast->extra.count = extra;
+    ast->funcs.count = funcs;
+
+    for (size_t i = 0; i < merged; i++) {
+        ParseChunk *c = &chunks.items[i];
+        for (size_t j = 0; j < c->stmts.count; j++) {
+            arena_da_append(ast->arena, stmts, SHIFT(c->stmts.items[j], c->shift.stmts));
+        }
+        arena_adopt(ast->arena, &c->keep);
+    }
+
+    bool ok = true;
+    if (merged < chunks.count) {
+        // parse the rest sequentially from here, that reports the errors in
+        // the order make_ast() would
+        Parser p = {0};
+        p.tokens = t;
+        p.current = chunks.items[merged].start;
+        p.ast = ast;
+        p.arena = ast->arena;
+        ok = parse_program(&p, stmts);
+    }
+
+    for (size_t i = 0; i < chunks.count; i++) {
+        arena_deinit(&chunks.items[i].nodes);
+        arena_deinit(&chunks.items[i].keep);
+    }
+    da_free(chunks);
+    return ok;
+}
+
+static const char *basetype_strs[TLAST] = {
+    [TS8]       = "s8",
+    [TS16]      = "s16",
+    [TS32]      = "s32",
+    [TS64]      = "s64",
+    [TU8]       = "u8",
+    [TU16]      = "u16",
+    [TU32]      = "u32",
+    [TU64]      = "u64",
+    [TF32]      = "f32",
+    [TF64]      = "f64",
+    [TBOOL]     = "bool",
+    [TCHAR]     = "char",
+    [TANY]      = "any",
+    [TVARIADIC] = "variadic",
+};
+
+// Interned copies of basetype_strs so both directions are pointer compares,
+// kept fresh by intern_parser_names().
+static const char *basetype_names[TLAST];
+
+static void intern_basetype_names(void) {
+    for (size_t i = 0; i < TLAST; i++) {
+        if (basetype_strs[i]) basetype_names[i] = intern_cstr(basetype_strs[i]);
+    }
+}
+
+const char *get_basetypekind_str(BaseTypeKind type) {
+    if (type >= TLAST) return NULL;
+    intern_parser_names();
+    return basetype_names[type];
+}
+
+BaseTypeKind str_to_basetypekind(const char *interned_name) {
+    intern_parser_names();
+    for (size_t i = 0; i < TLAST; i++) {
+        if (basetype_names[i] && basetype_names[i] == interned_name) return (BaseTypeKind)i;
+    }
     return TLAST;
 }
 
@@ -34,21 +34,29 @@ typedef enum {
     STMT_STRUCT_DEF,
 } StmtType;
 
-typedef struct Expr Expr;
-typedef struct Stmt Stmt;
 typedef struct Type Type;
 
+// The AST is a set of flat node arrays in an Ast, nodes refer to each other
+// by 32-bit handles (indices), not pointers. Children are pushed before their
+// parent, so the arrays are in parse order and a walk mostly streams forward
+// through them. Slot 0 of every array is reserved, so AST_NONE is "no node".
+typedef uint32_t ExprId;
+typedef uint32_t StmtId;
+
+#define AST_NONE 0
+
+// Top level statements of a program.
 typedef struct {
-    Stmt   **items;
+    StmtId *items;
     size_t count;
     size_t capacity;
 } Statements;
 
+// @NOTE: every name in the AST is interned (see intern.h), compare them by pointer.
 typedef struct {
-    char *name;
+    const char *name;
     Type *type;
     SrcLoc loc;
-    void *resolved_symbol;
 } Param;
 
 typedef struct {
@@ -57,47 +65,145 @@ typedef struct {
     size_t capacity;
 } Params;
 
+// Expression node, what `a` and `b` hold depends on the type:
+//
+//   EXPR_LITERAL_INT     a | b << 32 is the value, op its signedness (see expr_int_unsigned)
+//   EXPR_LITERAL_FLOAT   a | b << 32 is the bits of the double
+//   EXPR_LITERAL_STRING  a | b << 32 is the NUL terminated string
+//   EXPR_IDENTIFIER      a | b << 32 is the interned name
+//   EXPR_UNARY_OP        op, a operand
+//   EXPR_BINARY_OP       op, a lhs, b rhs
+//   EXPR_ASSIGN          a target, b value
+//   EXPR_INDEX           a object, b index
+//   EXPR_CALL            a callee, b list of arguments
+//   EXPR_COMPOUND_LIT    a list of expressions
+//   EXPR_FUNCTION        a index into Ast.funcs
+//
+// A list is an index into Ast.extra holding the count and then the items.
 typedef struct {
-    Expr **items;
-    size_t count;
-    size_t capacity;
-} Args;
-
+    uint8_t type; // ExprType
+    uint8_t op;   // TokenKind
+    uint32_t a;
+    uint32_t b;
+} ExprNode;
+
+#define STMT_FLAG_EXTERN 0x1
+
+// Statement node. Names index Ast.names and types index Ast.types, where
+// AST_NONE means there was no annotation.
+//
+//   STMT_EXPR         a expression
+//   STMT_RET          a expression or AST_NONE
+//   STMT_LET          a name, b type, c value, flags STMT_FLAG_EXTERN
+//   STMT_CONST        a name, b type, c value
+//   STMT_IF           a condition, b then, c else or AST_NONE
+//   STMT_FOR          a init, b condition, c index into Ast.extra holding
+//                     the increment and the body (any but the body may be AST_NONE)
+//   STMT_BLOCK        a list of statements
+//   STMT_DEFER        a statement
+//   STMT_ENUM_DEF     a name, b index into Ast.extra holding the count and
+//                     then name, value (or AST_NONE) per variant
+//   STMT_STRUCT_DEF   a name, b index into Ast.extra holding the count and
+//                     then name, type, value (or AST_NONE) per member
 typedef struct {
-    char *name;
-    Expr *value;
-} EnumVariant;
-
+    uint8_t type;  // StmtType
+    uint8_t flags;
+    uint32_t a;
+    uint32_t b;
+    uint32_t c;
+} StmtNode;
+
+// Function literals are rare, they keep their parameters out of the nodes.
 typedef struct {
-    EnumVariant *items;
-    size_t count;
-    size_t capacity;
-} EnumVariants;
+    Type *ret;
+    Params params;
+    StmtId body; // always a STMT_BLOCK
+} AstFunction;
 
 typedef struct {
-    char *name;
-    Type *type;
-    Expr *value;
-} StructureMember;
-
+    Arena *arena; // every array below lives in it
+    struct {
+        ExprNode *items;
+        SrcLoc *locs; // side table, same index
+        size_t count;
+        size_t capacity;
+    } exprs;
+    struct {
+        StmtNode *items;
+        SrcLoc *locs; // side table, same index
+        size_t count;
+        size_t capacity;
+    } stmts;
+    struct {
+        const char **items;
+        size_t count;
+        size_t capacity;
+    } names;
+    struct {
+        Type **items;
+        size_t count;
+        size_t capacity;
+    } types;
+    struct {
+        uint32_t *items;
+        size_t count;
+        size_t capacity;
+    } extra;
+    struct {
+        AstFunction *items;
+        size_t count;
+        size_t capacity;
+    } funcs;
+} Ast;
+
+// An operator waiting for its operand, see parse_expression().
 typedef struct {
-    StructureMember *items;
-    size_t count;
-    size_t capacity;
-} Structure;
+    uint8_t kind;   // FrameKind
+    uint8_t op;     // TokenKind
+    uint8_t min_bp; // of the expression the operator is in
+    ExprId lhs;
+    SrcLoc loc;
+    uint32_t args;  // calls: where the arguments start on the scratch stack
+} ExprFrame;
+
+#define PARSER_WINDOW 8 // must be a power of two
 
+// The parser either walks a finished token array (`tokens`), or decodes
+// tokens on demand from `lexer` or `packed`, keeping only the last
+// PARSER_WINDOW of them.
+// @NOTE: in those modes a Token* is only valid until the parser moves
+//        PARSER_WINDOW tokens further, copy tokens you hold across a parse.
 typedef struct {
     Tokens *tokens;
+    Lexer *lexer;
+    PackedTokens *packed;
+    PackedReader reader;
+    Token window[PARSER_WINDOW];
+    size_t decoded[PARSER_WINDOW]; // packed: token index + 1 held by each slot
+    size_t pulled;
     size_t current;
-    Arena *arena;
+    Ast *ast;
+    Arena *arena; // types, literals and parameters, ast->arena unless parsing a chunk
+    // Children of the lists being parsed, innermost list on top. Closing a
+    // list copies its run out to an exact-size slice and pops it, so the
+    // stacks only grow to the widest set of open lists and get reused.
+    struct {
+        uint32_t *items;
+        size_t count;
+        size_t capacity;
+    } scratch;
+    Params params;
+    struct {
+        ExprFrame *items;
+        size_t count;
+        size_t capacity;
+    } frames;
+    // Parsing one chunk for make_ast_parallel(): errors are not printed,
+    // only flagged in `failed`.
+    bool chunk;
+    bool failed;
 } Parser;
 
-typedef struct {
-    Expr **items;
-    size_t count;
-    size_t capacity;
-} ExprArr;
-
 typedef enum {
     TYPE_BASE,      // s32, s64, etc
     TYPE_POINTER,   // *T
@@ -129,7 +235,7 @@ typedef enum {
 } BaseTypeKind;
 
 const char *get_basetypekind_str(BaseTypeKind type);
-BaseTypeKind str_to_basetypekind(const char *name);
+BaseTypeKind str_to_basetypekind(const char *interned_name);
 const char *get_type_string(Type *t);
 
 struct Type {
@@ -150,7 +256,7 @@ struct Type {
         // T[]
         struct {
             Type *element;
-            Expr *size;
+            ExprId size; // AST_NONE for T[]
         } array;
 
         // fn(T1, T2) -> T3
@@ -160,11 +266,11 @@ struct Type {
         } function;
 
         struct {
-            EnumVariants *variants;
+            StmtId def; // the STMT_ENUM_DEF
         } enum_type;
 
         struct {
-            Structure *members;
+            StmtId def; // the STMT_STRUCT_DEF
         } struct_type;
 
         struct {
@@ -173,132 +279,57 @@ struct Type {
     } as;
 };
 
-struct Stmt {
-    StmtType type;
-    SrcLoc loc;
-    void *resolved_symbol; // save the symbol from pass 2 here
-
-    union {
-        // Expression statement
-        struct {
-            Expr *expr;
-        } expr;
-
-        // let a = expr;
-        struct {
-            char *name;
-            Type *type;
-            Expr *value;
-            // @TODO: in the future refactor this to a proper flag not just bool like this!
-            bool extern_symbol;
-        } let;
-
-        struct {
-            Stmt *callback;
-        } defer;
-
-        struct {
-            char *name;
-            Type *type;
-            Expr *value;
-        } const_stmt;
-
-        // if (cond) then_b else else_b
-        struct {
-            Expr *condition;
-            Stmt *then_b;
-            Stmt *else_b;
-        } if_stmt;
-
-        // for (init; cond; inc) body
-        struct {
-            Stmt *init;      // can be NULL
-            Expr *condition; // can be NULL
-            Expr *increment; // can be NULL
-            Stmt *body;
-            void *created_scope; // save scope here
-        } for_stmt;
-
-        struct {
-            char *name;
-            EnumVariants variants;
-        } enum_def;
-
-        // @TODO: this is a really bad type name update that later
-        struct {
-            char *name;
-            Structure members;
-        } struct_def;
-
-        // { ... }
-        struct {
-            Statements statements;
-            void *created_scope; // save scope here
-        } block;
-
-    } as;
-};
-
-struct Expr {
-    ExprType type;
-    SrcLoc loc;
-    void *resolved_symbol; // save the symbol from pass 2 here
-    Type *resolved_type; // save the resolved type from pass 2 here
-
-    union {
-        // Literals
-        uint64_t uint_val;
-        double float_val;
-        char *identifier;
-
-        // Unary Op (e.g., -5, !flag, ~bits)
-        struct {
-            int op; // The token type (T_MIN, T_NOT, T_BIT_NOT, etc)
-            Expr *right;
-        } unary;
-
-        // a[stuff]
-        struct {
-            Expr *object;
-            Expr *index;
-        } index;
-
-        // a = expr;
-        struct {
-            Expr *target;
-            Expr *value;
-        } assign;
-
-        struct {
-            ExprArr target;
-        } compound_literal;
-
-        // function
-        struct {
-            Type *ret;
-            Params params;
-            Stmt *body;   // must be block
-        } function;
-
-        // function call
-        struct {
-            Expr *callee;
-            Args args;
-        } call;
-
-        // Binary Op (e.g., 5 + 5, a == b, x && y)
-        struct {
-            int op; // The token type (T_PLUS, T_MIN, T_EQ, T_AND, etc)
-            Expr *left;
-            Expr *right;
-        } binary;
-    } as;
-};
+void ast_init(Ast *ast, Arena *a);
+ExprId ast_push_expr(Ast *ast, ExprNode node, SrcLoc loc);
+StmtId ast_push_stmt(Ast *ast, StmtNode node, SrcLoc loc);
+uint32_t ast_push_name(Ast *ast, const char *interned_name);
+uint32_t ast_push_type(Ast *ast, Type *t);
+uint32_t ast_push_extra(Ast *ast, const uint32_t *items, size_t count);
+
+static inline ExprNode *ast_expr(const Ast *ast, ExprId id) { return &ast->exprs.items[id]; }
+static inline StmtNode *ast_stmt(const Ast *ast, StmtId id) { return &ast->stmts.items[id]; }
+static inline SrcLoc ast_expr_loc(const Ast *ast, ExprId id) { return ast->exprs.locs[id]; }
+static inline SrcLoc ast_stmt_loc(const Ast *ast, StmtId id) { return ast->stmts.locs[id]; }
+static inline const char *ast_name(const Ast *ast, uint32_t name) { return ast->names.items[name]; }
+static inline Type *ast_type(const Ast *ast, uint32_t type) { return ast->types.items[type]; }
+static inline uint32_t *ast_extra(const Ast *ast, uint32_t at) { return &ast->extra.items[at]; }
+static inline uint32_t ast_list_count(const Ast *ast, uint32_t list) { return ast->extra.items[list]; }
+static inline uint32_t *ast_list_items(const Ast *ast, uint32_t list) { return &ast->extra.items[list + 1]; }
+static inline AstFunction *ast_func(const Ast *ast, uint32_t func) { return &ast->funcs.items[func]; }
+
+// Leaf payloads, see ExprNode.
+static inline ExprNode expr_leaf(ExprType type, uint64_t payload) {
+    return (ExprNode){ .type = type, .a = (uint32_t)payload, .b = (uint32_t)(payload >> 32) };
+}
+static inline uint64_t expr_payload(const ExprNode *e) { return (uint64_t)e->a | (uint64_t)e->b << 32; }
+
+// An integer literal from the source leaves `op` at 0 and is signed when it
+// fits in s64, unsigned otherwise, like in C. Constants folded by the parser
+// say which one they are, a negative s64 would look like a big unsigned.
+#define INT_LIT_SIGNED   1
+#define INT_LIT_UNSIGNED 2
+static inline bool expr_int_unsigned(const ExprNode *e) {
+    if (e->op != 0) return e->op == INT_LIT_UNSIGNED;
+    return expr_payload(e) > INT64_MAX;
+}
+static inline const char *expr_str(const ExprNode *e) { return (const char *)(uintptr_t)expr_payload(e); }
+static inline double expr_float(const ExprNode *e) {
+    uint64_t bits = expr_payload(e);
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
 
-Expr *make_expr(ExprType type, Arena *a);
-Stmt *make_stmt(StmtType type, Arena *a);
 Type *make_type(Arena *a, TypeKind kind);
-bool make_ast(Arena *a, Statements *stmts, Tokens *t);
-void print_stmt(Stmt *s, int indent);
+// The make_ast* functions append the top level statements to `stmts`, which
+// grows in ast->arena, like everything else the parser allocates.
+bool make_ast(Ast *ast, Statements *stmts, Tokens *t);
+bool make_ast_stream(Ast *ast, Statements *stmts, Lexer *l);
+bool make_ast_packed(Ast *ast, Statements *stmts, PackedTokens *pt);
+// Same AST as make_ast, but the tokens are cut into chunks of whole top
+// level statements that are parsed on `threads` threads (0 = one per online
+// CPU) and merged in source order.
+bool make_ast_parallel(Ast *ast, Statements *stmts, Tokens *t, size_t threads);
+void print_stmt(const Ast *ast, StmtId s, int indent);
 
 #endif // AST_H
@@ -0,0 +1,283 @@
+#define ARENA_IMPLEMENTATION
+#include "arena.h"
+#undef ARENA_IMPLEMENTATION
+
+#include <unistd.h>
+#include <fcntl.h>
+#include "utils.h"
+#include "lexer.h"
+#include "ast.h"
+#include "semantic.h"
+#include "source.h"
+#include "intern.h"
+
+// Front end benchmark, built and started by `./nob bench`.
+//
+//   sawit_bench [-n RUNS] [-json OUT] [-baseline FILE] [-threshold PCT] [FILES...]
+//
+// Every run lexes (parse_tokens_v2), parses (make_ast) and checks (the
+// three semantic passes) the whole corpus with fresh arenas and times each
+// phase over all files. The report has min/median/p99 per phase plus MB/s
+// and tokens/s at the median. With -baseline the medians are compared to a
+// JSON written by an earlier -json run, and any phase slower by more than
+// the threshold makes the exit status 1.
+
+#define BENCH_DEFAULT_RUNS      200
+#define BENCH_DEFAULT_THRESHOLD 10.0 // percent
+#define BENCH_DEFAULT_CORPUS    "main.swt", "test.swt"
+
+typedef enum {
+    PHASE_LEX,
+    PHASE_AST,
+    PHASE_SEMANTIC,
+    PHASE_COUNT,
+} Phase;
+
+static const char *phase_names[PHASE_COUNT] = {
+    [PHASE_LEX]      = "lex",
+    [PHASE_AST]      = "ast",
+    [PHASE_SEMANTIC] = "semantic",
+};
+
+typedef struct {
+    double min, median, p99; // ms
+    double mb_per_s, tokens_per_s;
+} PhaseStats;
+
+typedef struct {
+    SourceFile **items;
+    size_t count;
+    size_t capacity;
+} Corpus;
+
+// Runs every phase over the corpus once and adds the time spent in each to
+// times[]. Returns false if the corpus does not lex or parse, semantic
+// errors are fine as long as they are the same every run.
+static bool bench_run(Corpus *corpus, double times[PHASE_COUNT], size_t *token_count) {
+    Arena tarena = {0};
+    Arena rarena = {0};
+    if (arena_init(&tarena, ARENA_DEFAULT_SIZE) != 0 || arena_init(&rarena, ARENA_DEFAULT_SIZE) != 0) {
+        perr_exit("Failed to allocate the bench arenas `%s`", strerror(errno));
+    }
+
+    bool result = false;
+    *token_count = 0;
+    for (size_t i = 0; i < corpus->count; i++) {
+        SourceFile *f = corpus->items[i];
+        Tokens tokens = {0};
+        Ast ast = {0};
+        ast_init(&ast, &rarena);
+        Statements program = {0};
+
+        long long start = current_time_ns();
+        if (!parse_tokens_v2(&tarena, &f->text, &tokens, f->name)) goto defer;
+        long long end = current_time_ns();
+        times[PHASE_LEX] += (double)(end - start) / 1e6;
+        *token_count += tokens.count;
+
+        start = current_time_ns();
+        if (!make_ast(&ast, &program, &tokens)) goto defer;
+        end = current_time_ns();
+        times[PHASE_AST] += (double)(end - start) / 1e6;
+
+        Semantic semantic = {0};
+        semantic.arena = &rarena;
+        semantic.ast = &ast;
+        start = current_time_ns();
+        (void)(semantic_check_pass_one(&semantic, &program)
+               && semantic_check_pass_two(&semantic, &program)
+               && semantic_check_pass_three(&semantic, &program));
+        end = current_time_ns();
+        times[PHASE_SEMANTIC] += (double)(end - start) / 1e6;
+    }
+    result = true;
+
+ defer:
+    arena_deinit(&rarena);
+    arena_deinit(&tarena);
+    return result;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static PhaseStats phase_stats(double *samples, size_t runs, size_t bytes, size_t tokens) {
+    qsort(samples, runs, sizeof(*samples), compare_double);
+    PhaseStats st = {0};
+    st.min = samples[0];
+    st.median = runs % 2 ? samples[runs / 2] : (samples[runs / 2 - 1] + samples[runs / 2]) / 2;
+    size_t p99 = (runs * 99 + 99) / 100; // ceil(runs * 0.99)
+    st.p99 = samples[p99 - 1];
+    if (st.median > 0) {
+        st.mb_per_s = (double)bytes / (1024.0 * 1024.0) / (st.median / 1e3);
+        st.tokens_per_s = (double)tokens / (st.median / 1e3);
+    }
+    return st;
+}
+
+static bool write_json(const char *path, Corpus *corpus, size_t runs, size_t bytes, size_t tokens,
+                       PhaseStats stats[PHASE_COUNT]) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        perr("Could not open `%s': %s", path, strerror(errno));
+        return false;
+    }
+
+    fprintf(f, "{\n");
+    fprintf(f, "  \"runs\": %zu,\n", runs);
+    fprintf(f, "  \"files\": [");
+    for (size_t i = 0; i < corpus->count; i++) {
+        fprintf(f, "%s\"%s\"", i ? ", " : "", corpus->items[i]->name);
+    }
+    fprintf(f, "],\n");
+    fprintf(f, "  \"bytes\": %zu,\n", bytes);
+    fprintf(f, "  \"tokens\": %zu,\n", tokens);
+    fprintf(f, "  \"phases\": [\n");
+    for (size_t p = 0; p < PHASE_COUNT; p++) {
+        PhaseStats *st = &stats[p];
+        fprintf(f, "    {\"phase\": \"%s\", \"min_ms\": %.6f, \"median_ms\": %.6f, \"p99_ms\": %.6f, "
+                   "\"mb_per_s\": %.3f, \"tokens_per_s\": %.1f}%s\n",
+                phase_names[p], st->min, st->median, st->p99, st->mb_per_s, st->tokens_per_s,
+                p + 1 < PHASE_COUNT ? "," : "");
+    }
+    fprintf(f, "  ]\n");
+    fprintf(f, "}\n");
+
+    bool ok = !ferror(f);
+    if (fclose(f) != 0) ok = false;
+    if (!ok) perr("Could not write `%s'", path);
+    return ok;
+}
+
+// @NOTE: this only reads back what write_json() produces, it is not a JSON parser.
+static bool baseline_median(const char *json, const char *phase, double *out) {
+    char key[64];
+    snprintf(key, sizeof(key), "\"phase\": \"%s\"", phase);
+    const char *at = strstr(json, key);
+    if (at == NULL) return false;
+    at = strstr(at, "\"median_ms\":");
+    if (at == NULL) return false;
+    at += strlen("\"median_ms\":");
+
+    char *end;
+    *out = strtod(at, &end);
+    return end != at;
+}
+
+// Returns the number of phases that regressed by more than threshold percent.
+static int compare_baseline(const char *path, PhaseStats stats[PHASE_COUNT], double threshold) {
+    String_Builder sb = {0};
+    if (!read_entire_file(path, &sb)) return -1;
+    sb_append_null(&sb);
+
+    printf("\nBaseline `%s' (threshold %.1f%%):\n", path, threshold);
+    int regressions = 0;
+    for (size_t p = 0; p < PHASE_COUNT; p++) {
+        double base;
+        if (!baseline_median(sb.items, phase_names[p], &base)) {
+            printf("  %-9s  missing from baseline\n", phase_names[p]);
+            continue;
+        }
+        double delta = base > 0 ? (stats[p].median - base) / base * 100.0 : 0.0;
+        bool regressed = delta > threshold;
+        regressions += regressed;
+        printf("  %-9s  %10.4f -> %10.4f ms  %+7.1f%%%s\n", phase_names[p], base, stats[p].median,
+               delta, regressed ? "  REGRESSION" : "");
+    }
+    da_free(sb);
+    return regressions;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-n RUNS] [-json OUT] [-baseline FILE] [-threshold PCT] [FILES...]\n", program);
+}
+
+int main(int argc, char **argv) {
+    const char *program = shift(argv, argc);
+    size_t runs = BENCH_DEFAULT_RUNS;
+    double threshold = BENCH_DEFAULT_THRESHOLD;
+    const char *json_path = NULL;
+    const char *baseline_path = NULL;
+
+    while (argc > 0 && argv[0][0] == '-') {
+        const char *flag = shift(argv, argc);
+        if (strcmp(flag, "-n") != 0 && strcmp(flag, "-json") != 0
+            && strcmp(flag, "-baseline") != 0 && strcmp(flag, "-threshold") != 0) {
+            usage(program);
+            perr_exit("Unknown flag `%s'", flag);
+        }
+        if (argc <= 0) {
+            usage(program);
+            perr_exit("Flag `%s' needs a value", flag);
+        }
+        const char *value = shift(argv, argc);
+        if (strcmp(flag, "-n") == 0)             runs = strtoul(value, NULL, 10);
+        else if (strcmp(flag, "-json") == 0)     json_path = value;
+        else if (strcmp(flag, "-baseline") == 0) baseline_path = value;
+        else                                     threshold = strtod(value, NULL);
+    }
+    if (runs == 0) perr_exit("-n must be at least 1");
+
+    Corpus corpus = {0};
+    const char *default_corpus[] = { BENCH_DEFAULT_CORPUS };
+    if (argc == 0) {
+        argv = (char **)default_corpus;
+        argc = ARRAY_LEN(default_corpus);
+    }
+    size_t bytes = 0;
+    for (int i = 0; i < argc; i++) {
+        SourceFile *f = source_open(argv[i]);
+        if (f == NULL) return 1;
+        bytes += f->text.count - 1;
+        da_append(&corpus, f);
+    }
+
+    // The first run is a warm up and shows the diagnostics once, the timed
+    // runs would only repeat them.
+    double times[PHASE_COUNT] = {0};
+    size_t tokens = 0;
+    if (!bench_run(&corpus, times, &tokens)) perr_exit("The corpus must lex and parse");
+
+    fflush(stderr);
+    int saved_stderr = dup(STDERR_FILENO);
+    int devnull = open("/dev/null", O_WRONLY);
+    if (saved_stderr >= 0 && devnull >= 0) dup2(devnull, STDERR_FILENO);
+
+    double *samples[PHASE_COUNT];
+    for (size_t p = 0; p < PHASE_COUNT; p++) samples[p] = malloc(runs * sizeof(double));
+    for (size_t r = 0; r < runs; r++) {
+        memset(times, 0, sizeof(times));
+        bench_run(&corpus, times, &tokens);
+        for (size_t p = 0; p < PHASE_COUNT; p++) samples[p][r] = times[p];
+    }
+
+    if (saved_stderr >= 0 && devnull >= 0) {
+        dup2(saved_stderr, STDERR_FILENO);
+        close(saved_stderr);
+        close(devnull);
+    }
+
+    PhaseStats stats[PHASE_COUNT];
+    printf("%zu files, %zu bytes, %zu tokens, %zu runs\n", corpus.count, bytes, tokens, runs);
+    printf("  %-9s  %10s  %10s  %10s  %10s  %14s\n", "phase", "min ms", "median ms", "p99 ms", "MB/s", "tokens/s");
+    for (size_t p = 0; p < PHASE_COUNT; p++) {
+        stats[p] = phase_stats(samples[p], runs, bytes, tokens);
+        printf("  %-9s  %10.4f  %10.4f  %10.4f  %10.2f  %14.0f\n", phase_names[p],
+               stats[p].min, stats[p].median, stats[p].p99, stats[p].mb_per_s, stats[p].tokens_per_s);
+        free(samples[p]);
+    }
+
+    int status = 0;
+    if (json_path != NULL && !write_json(json_path, &corpus, runs, bytes, tokens, stats)) status = 1;
+    if (baseline_path != NULL) {
+        int regressions = compare_baseline(baseline_path, stats, threshold);
+        if (regressions != 0) status = 1;
+    }
+
+    da_free(corpus);
+    source_manager_free();
+    intern_deinit();
+    return status;
+}
@@ -0,0 +1,477 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#define NOB_STRIP_PREFIX
+#include "nob.h"
+#include "utils.h"
+
+// Synthetic corpus generator, built and started by `./nob gen`.
+//
+//   sawit_gen [-seed N] [-size BYTES[K|M|G]] [-shape NAME] [-depth N]
+//             [-chain N] [-params N] [-o FILE]
+//
+// Writes top level items until the output reaches -size bytes. The same
+// seed and flags always give the same bytes. Shapes:
+//   mix      all of the below, picked at random per item (default)
+//   decls    let, const, struct and enum declarations
+//   nested   functions with -depth levels of blocks, for and if
+//   exprs    let with a -chain operator long expression
+//   params   functions taking -params parameters, and calls to them
+//   strings  string literals with escapes and multi byte UTF-8
+//   idents   many distinct long names, each used a few times
+// Programs only use what the lexer and parser accept, and every name is
+// declared once before it is used, so semantic passes one and two pass.
+
+#define GEN_FLUSH_AT (1u << 20)
+
+typedef enum {
+    SHAPE_MIX,
+    SHAPE_DECLS,
+    SHAPE_NESTED,
+    SHAPE_EXPRS,
+    SHAPE_PARAMS,
+    SHAPE_STRINGS,
+    SHAPE_IDENTS,
+    SHAPE_COUNT,
+} Shape;
+
+static const char *shape_names[SHAPE_COUNT] = {
+    [SHAPE_MIX]     = "mix",
+    [SHAPE_DECLS]   = "decls",
+    [SHAPE_NESTED]  = "nested",
+    [SHAPE_EXPRS]   = "exprs",
+    [SHAPE_PARAMS]  = "params",
+    [SHAPE_STRINGS] = "strings",
+    [SHAPE_IDENTS]  = "idents",
+};
+
+typedef struct {
+    uint32_t *items;
+    size_t count;
+    size_t capacity;
+} Ids;
+
+typedef struct {
+    FILE *out;
+    String_Builder sb;
+    uint64_t written;
+    uint64_t rng;
+
+    size_t depth;
+    size_t chain;
+    size_t params;
+
+    uint32_t next_id;
+    Ids vars;  // integer globals expressions may read
+    Ids funcs; // functions taking `params` integer parameters
+} Gen;
+
+// ---------------------------------------------------------------------------
+// Output and randomness
+// ---------------------------------------------------------------------------
+
+static void gen_flush(Gen *g) {
+    if (g->sb.count == 0) return;
+    if (fwrite(g->sb.items, 1, g->sb.count, g->out) != g->sb.count) {
+        perr_exit("Could not write the corpus: %s", strerror(errno));
+    }
+    g->written += g->sb.count;
+    g->sb.count = 0;
+}
+
+static uint64_t gen_size(Gen *g) {
+    return g->written + g->sb.count;
+}
+
+#define emit(g, ...) sb_appendf(&(g)->sb, __VA_ARGS__)
+
+static void emit_indent(Gen *g, size_t level) {
+    for (size_t i = 0; i < level; i++) sb_append_cstr(&g->sb, "    ");
+}
+
+// splitmix64, so a seed means the same corpus everywhere
+static uint64_t rand_u64(Gen *g) {
+    uint64_t z = (g->rng += 0x9E3779B97F4A7C15ull);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+    return z ^ (z >> 31);
+}
+
+// [0, n)
+static size_t rand_below(Gen *g, size_t n) {
+    return (size_t)(rand_u64(g) % n);
+}
+
+static bool rand_chance(Gen *g, size_t percent) {
+    return rand_below(g, 100) < percent;
+}
+
+// ---------------------------------------------------------------------------
+// Names
+// ---------------------------------------------------------------------------
+
+// Every declaration gets a fresh id. The id is scrambled with an odd
+// multiplier (a bijection on 32 bits) and spelled in base 26, so names are
+// unique and do not share long prefixes. The underscore after the prefix
+// keeps them clear of the keywords.
+static void emit_name(Gen *g, const char *prefix, uint32_t id) {
+    uint32_t x = id * 0x9E3779B1u;
+    char buf[16];
+    size_t n = 0;
+    do {
+        buf[n++] = (char)('a' + x % 26);
+        x /= 26;
+    } while (x != 0);
+    emit(g, "%s_%.*s", prefix, (int)n, buf);
+}
+
+// A longer name for the idents shape, still unique because it ends in the
+// short one.
+static void emit_long_name(Gen *g, const char *prefix, uint32_t id) {
+    static const char *parts[] = {
+        "buffer", "count", "index", "offset", "length", "cursor", "result", "value",
+        "state", "token", "scope", "symbol", "node", "entry", "table", "width",
+    };
+    emit(g, "%s", prefix);
+    size_t n = 2 + rand_below(g, 3);
+    for (size_t i = 0; i < n; i++) emit(g, "_%s", parts[rand_below(g, ARRAY_LEN(parts))]);
+    emit_name(g, "", id);
+}
+
+// ---------------------------------------------------------------------------
+// Types and expressions
+// ---------------------------------------------------------------------------
+
+static const char *int_types[] = { "s8", "s16", "s32", "s64", "u8", "u16", "u32", "u64" };
+static const char *binary_ops[] = { "+", "-", "*", "/", "%", "&", "|", "^", "<<", ">>" };
+
+static void emit_int_literal(Gen *g) {
+    switch (rand_below(g, 6)) {
+    case 0:  emit(g, "0x%zX", 1 + rand_below(g, 0xFFFF)); break;
+    case 1:  emit(g, "0b%s", rand_chance(g, 50) ? "1011" : "110"); break;
+    default: emit(g, "%zu", 1 + rand_below(g, 1000)); break;
+    }
+}
+
+// An integer operand: a literal, a global, or a parenthesized sub chain.
+static void emit_operand(Gen *g, size_t budget) {
+    size_t pick = rand_below(g, 10);
+    if (pick < 2 && budget > 2) {
+        size_t len = 1 + rand_below(g, budget / 2);
+        emit(g, "(");
+        emit_operand(g, 0);
+        for (size_t i = 0; i < len; i++) {
+            emit(g, " %s ", binary_ops[rand_below(g, ARRAY_LEN(binary_ops))]);
+            emit_operand(g, 0);
+        }
+        emit(g, ")");
+    } else if (pick < 6 && g->vars.count > 0) {
+        if (pick == 2) emit(g, rand_chance(g, 50) ? "-" : "~");
+        emit_name(g, "g", g->vars.items[rand_below(g, g->vars.count)]);
+    } else {
+        emit_int_literal(g);
+    }
+}
+
+static void emit_chain(Gen *g, size_t len) {
+    emit_operand(g, len);
+    for (size_t i = 0; i < len; i++) {
+        emit(g, " %s ", binary_ops[rand_below(g, ARRAY_LEN(binary_ops))]);
+        emit_operand(g, len - i);
+    }
+}
+
+static void emit_string_literal(Gen *g, size_t words) {
+    static const char *pieces[] = {
+        "lorem", "ipsum", "sawit", "kelapa", "durian", "\\n", "\\t", "\\\"", "\\\\",
+        "caf\xC3\xA9", "\xE6\x97\xA5\xE6\x9C\xAC", "\xF0\x9F\x8C\xB4", "100%", "a{b}c",
+    };
+    emit(g, "\"");
+    for (size_t i = 0; i < words; i++) {
+        if (i) emit(g, " ");
+        emit(g, "%s", pieces[rand_below(g, ARRAY_LEN(pieces))]);
+    }
+    emit(g, "\"");
+}
+
+// ---------------------------------------------------------------------------
+// Top level items
+// ---------------------------------------------------------------------------
+
+static void gen_let_int(Gen *g, size_t chain) {
+    uint32_t id = g->next_id++;
+    emit(g, "let ");
+    emit_name(g, "g", id);
+    emit(g, " %s = ", int_types[rand_below(g, ARRAY_LEN(int_types))]);
+    emit_chain(g, chain);
+    emit(g, ";\n");
+    da_append(&g->vars, id);
+}
+
+static void gen_decls(Gen *g) {
+    switch (rand_below(g, 5)) {
+    case 0:
+    case 1: {
+        gen_let_int(g, rand_below(g, 3));
+    } break;
+    case 2: {
+        emit(g, "const ");
+        emit_name(g, "c", g->next_id++);
+        emit(g, " = ");
+        if (rand_chance(g, 50)) emit(g, "%zu.%zue%d", rand_below(g, 100), rand_below(g, 1000), (int)rand_below(g, 9) - 4);
+        else emit_int_literal(g);
+        emit(g, ";\n");
+    } break;
+    case 3: {
+        uint32_t id = g->next_id++;
+        emit(g, "struct ");
+        emit_name(g, "S", id);
+        emit(g, " = {\n");
+        size_t members = 1 + rand_below(g, 8);
+        for (size_t i = 0; i < members; i++) {
+            emit(g, "    m%zu ", i);
+            switch (rand_below(g, 4)) {
+            case 0:  emit(g, "*u8"); break;
+            case 1:  emit(g, "[%zu]f64", 1 + rand_below(g, 16)); break;
+            case 2:  emit(g, "f32 = %zu.5", rand_below(g, 100)); break;
+            default: emit(g, "%s", int_types[rand_below(g, ARRAY_LEN(int_types))]); break;
+            }
+            emit(g, ";\n");
+        }
+        emit(g, "};\n");
+    } break;
+    case 4: {
+        emit(g, "enum ");
+        emit_name(g, "E", g->next_id++);
+        emit(g, " = {\n");
+        size_t variants = 1 + rand_below(g, 12);
+        for (size_t i = 0; i < variants; i++) {
+            emit(g, "    V%zu", i);
+            if (rand_chance(g, 30)) emit(g, " = %zu", i * 4);
+            emit(g, ";\n");
+        }
+        emit(g, "};\n");
+    } break;
+    }
+}
+
+// Locals are named after their nesting level, so a name is never declared
+// twice in one scope chain and siblings reuse the same names.
+static void emit_nested(Gen *g, size_t level, size_t depth) {
+    if (depth == 0) {
+        emit_indent(g, level);
+        emit(g, "t0 = t0 + %zu;\n", 1 + rand_below(g, 9));
+        return;
+    }
+
+    size_t d = depth;
+    emit_indent(g, level);
+    switch (rand_below(g, 3)) {
+    case 0: {
+        emit(g, "for (let i%zu s64 = 0; i%zu < %zu; i%zu = i%zu + 1) {\n", d, d, 1 + rand_below(g, 64), d, d);
+        emit_nested(g, level + 1, depth - 1);
+        emit_indent(g, level);
+        emit(g, "}\n");
+    } break;
+    case 1: {
+        emit(g, "if (t0 > %zu) {\n", rand_below(g, 100));
+        emit_nested(g, level + 1, depth - 1);
+        emit_indent(g, level);
+        if (rand_chance(g, 50)) {
+            // only one branch goes deeper, or the size doubles per level
+            emit(g, "} else {\n");
+            emit_nested(g, level + 1, 0);
+            emit_indent(g, level);
+        }
+        emit(g, "}\n");
+    } break;
+    case 2: {
+        emit(g, "{\n");
+        emit_indent(g, level + 1);
+        emit(g, "let t%zu s64 = t0 * 2;\n", d);
+        emit_nested(g, level + 1, depth - 1);
+        emit_indent(g, level);
+        emit(g, "}\n");
+    } break;
+    }
+}
+
+static void gen_nested(Gen *g) {
+    emit(g, "let ");
+    emit_name(g, "f", g->next_id++);
+    emit(g, " = fn (a s64) -> s64 {\n");
+    emit(g, "    let t0 s64 = a;\n");
+    emit_nested(g, 1, g->depth);
+    emit(g, "    return t0;\n");
+    emit(g, "};\n");
+}
+
+static void gen_exprs(Gen *g) {
+    gen_let_int(g, g->chain);
+}
+
+static void gen_params(Gen *g) {
+    if (g->funcs.count > 0 && rand_chance(g, 50)) {
+        emit_name(g, "f", g->funcs.items[rand_below(g, g->funcs.count)]);
+        emit(g, "(");
+        for (size_t i = 0; i < g->params; i++) {
+            if (i) emit(g, ", ");
+            emit_operand(g, 0);
+        }
+        emit(g, ");\n");
+        return;
+    }
+
+    uint32_t id = g->next_id++;
+    emit(g, "let ");
+    emit_name(g, "f", id);
+    emit(g, " = fn (");
+    for (size_t i = 0; i < g->params; i++) {
+        if (i) emit(g, ", ");
+        emit(g, "p%zu %s", i, int_types[rand_below(g, ARRAY_LEN(int_types))]);
+    }
+    emit(g, ") -> s64 {\n");
+    emit(g, "    return ");
+    for (size_t i = 0; i < g->params; i++) {
+        if (i) emit(g, " + ");
+        emit(g, "p%zu", i);
+    }
+    if (g->params == 0) emit(g, "0");
+    emit(g, ";\n");
+    emit(g, "};\n");
+    da_append(&g->funcs, id);
+}
+
+static void gen_strings(Gen *g) {
+    emit(g, "let ");
+    emit_name(g, "s", g->next_id++);
+    emit(g, " = ");
+    emit_string_literal(g, 4 + rand_below(g, 60));
+    emit(g, ";\n");
+}
+
+static void gen_idents(Gen *g) {
+    uint32_t id = g->next_id++;
+    emit(g, "let ");
+    emit_name(g, "g", id);
+    emit(g, " s64 = ");
+    size_t uses = g->vars.count < 4 ? g->vars.count : 4;
+    for (size_t i = 0; i < uses; i++) {
+        emit_name(g, "g", g->vars.items[rand_below(g, g->vars.count)]);
+        emit(g, " + ");
+    }
+    emit(g, "%zu;\n", rand_below(g, 100));
+    da_append(&g->vars, id);
+
+    // the long name is never read, it only adds to the intern table
+    emit(g, "let ");
+    emit_long_name(g, "v", g->next_id++);
+    emit(g, " = ");
+    emit_name(g, "g", id);
+    emit(g, ";\n");
+}
+
+typedef void (*GenItem)(Gen *g);
+
+static const GenItem generators[SHAPE_COUNT] = {
+    [SHAPE_DECLS]   = gen_decls,
+    [SHAPE_NESTED]  = gen_nested,
+    [SHAPE_EXPRS]   = gen_exprs,
+    [SHAPE_PARAMS]  = gen_params,
+    [SHAPE_STRINGS] = gen_strings,
+    [SHAPE_IDENTS]  = gen_idents,
+};
+
+// ---------------------------------------------------------------------------
+// Command line
+// ---------------------------------------------------------------------------
+
+static uint64_t parse_size(const char *s) {
+    char *end;
+    uint64_t n = strtoull(s, &end, 10);
+    switch (*end) {
+    case 'k': case 'K': n <<= 10; end++; break;
+    case 'm': case 'M': n <<= 20; end++; break;
+    case 'g': case 'G': n <<= 30; end++; break;
+    default: break;
+    }
+    if (end == s || *end != '\0') perr_exit("Invalid size `%s'", s);
+    return n;
+}
+
+static size_t parse_count(const char *flag, const char *s) {
+    char *end;
+    unsigned long long n = strtoull(s, &end, 10);
+    if (end == s || *end != '\0') perr_exit("Invalid value `%s' for %s", s, flag);
+    return (size_t)n;
+}
+
+static void usage(const char *program) {
+    fprintf(stderr, "Usage: %s [-seed N] [-size BYTES[K|M|G]] [-shape NAME] [-depth N] [-chain N] [-params N] [-o FILE]\n", program);
+    fprintf(stderr, "Shapes:");
+    for (size_t i = 0; i < SHAPE_COUNT; i++) fprintf(stderr, " %s", shape_names[i]);
+    fprintf(stderr, "\n");
+}
+
+int main(int argc, char **argv) {
+    const char *program = shift(argv, argc);
+    uint64_t seed = 1;
+    uint64_t size = 1u << 20;
+    Shape shape = SHAPE_MIX;
+    const char *out_path = NULL;
+    Gen g = { .depth = 8, .chain = 16, .params = 8 };
+
+    while (argc > 0) {
+        const char *flag = shift(argv, argc);
+        if (argc <= 0) {
+            usage(program);
+            perr_exit("Flag `%s' needs a value", flag);
+        }
+        const char *value = shift(argv, argc);
+        if (strcmp(flag, "-seed") == 0)        seed = parse_count(flag, value);
+        else if (strcmp(flag, "-size") == 0)   size = parse_size(value);
+        else if (strcmp(flag, "-depth") == 0)  g.depth = parse_count(flag, value);
+        else if (strcmp(flag, "-chain") == 0)  g.chain = parse_count(flag, value);
+        else if (strcmp(flag, "-params") == 0) g.params = parse_count(flag, value);
+        else if (strcmp(flag, "-o") == 0)      out_path = value;
+        else if (strcmp(flag, "-shape") == 0) {
+            size_t i = 0;
+            while (i < SHAPE_COUNT && strcmp(shape_names[i], value) != 0) i++;
+            if (i == SHAPE_COUNT) {
+                usage(program);
+                perr_exit("Unknown shape `%s'", value);
+            }
+            shape = (Shape)i;
+        } else {
+            usage(program);
+            perr_exit("Unknown flag `%s'", flag);
+        }
+    }
+
+    g.out = stdout;
+    if (out_path != NULL) {
+        g.out = fopen(out_path, "wb");
+        if (g.out == NULL) perr_exit("Could not open `%s': %s", out_path, strerror(errno));
+    }
+    g.rng = seed;
+
+    emit(&g, "// sawit_gen -seed %llu -size %llu -shape %s -depth %zu -chain %zu -params %zu\n",
+         (unsigned long long)seed, (unsigned long long)size, shape_names[shape], g.depth, g.chain, g.params);
+    while (gen_size(&g) < size) {
+        Shape s = shape;
+        if (s == SHAPE_MIX) s = (Shape)(1 + rand_below(&g, SHAPE_COUNT - 1));
+        generators[s](&g);
+        if (g.sb.count >= GEN_FLUSH_AT) gen_flush(&g);
+    }
+    gen_flush(&g);
+
+    if (out_path != NULL && fclose(g.out) != 0) {
+        perr_exit("Could not write `%s': %s", out_path, strerror(errno));
+    }
+    sb_free(g.sb);
+    da_free(g.vars);
+    da_free(g.funcs);
+    return 0;
+}
@@ -0,0 +1,155 @@
+#include "intern.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "arena.h"
+#include "utils.h"
+
+#define INTERN_INIT_CAP 1024
+
+typedef struct {
+    InternEntry **slots;
+    size_t cap;
+    size_t count;
+    Arena strings;
+} Interner;
+
+static Interner interner = {0};
+static uint32_t generation = 1;
+
+// wyhash (final version 4, public domain by Wang Yi). Short names, which
+// is most identifiers, take two overlapping loads and two 128-bit
+// multiplies instead of a multiply per byte.
+static const uint64_t wyp[4] = {
+    0x2d358dccaa6c78a5ull, 0x8bb84b93962eacc9ull, 0x4b33a62ed433d4a3ull, 0x4d5a2da51de1aa47ull,
+};
+
+static inline void wy_mum(uint64_t *a, uint64_t *b) {
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+}
+
+static inline uint64_t wy_mix(uint64_t a, uint64_t b) {
+    wy_mum(&a, &b);
+    return a ^ b;
+}
+
+static inline uint64_t wy_r8(const unsigned char *p) {
+    uint64_t v;
+    memcpy(&v, p, 8);
+    return v;
+}
+
+static inline uint64_t wy_r4(const unsigned char *p) {
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return v;
+}
+
+// 1 to 3 bytes
+static inline uint64_t wy_r3(const unsigned char *p, size_t k) {
+    return ((uint64_t)p[0] << 16) | ((uint64_t)p[k >> 1] << 8) | p[k - 1];
+}
+
+uint64_t intern_hash_bytes(const char *s, size_t len) {
+    const unsigned char *p = (const unsigned char *)s;
+    uint64_t seed = wy_mix(wyp[0], wyp[1]); // seed 0
+    uint64_t a, b;
+    if (len <= 16) {
+        if (len >= 4) {
+            a = (wy_r4(p) << 32) | wy_r4(p + ((len >> 3) << 2));
+            b = (wy_r4(p + len - 4) << 32) | wy_r4(p + len - 4 - ((len >> 3) << 2));
+        } else if (len > 0) {
+            a = wy_r3(p, len);
+            b = 0;
+        } else {
+            a = b = 0;
+        }
+    } else {
+        size_t i = len;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = wy_mix(wy_r8(p) ^ wyp[1], wy_r8(p + 8) ^ seed);
+                see1 = wy_mix(wy_r8(p + 16) ^ wyp[2], wy_r8(p + 24) ^ see1);
+                see2 = wy_mix(wy_r8(p + 32) ^ wyp[3], wy_r8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while (i > 16) {
+            seed = wy_mix(wy_r8(p) ^ wyp[1], wy_r8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = wy_r8(p + i - 16);
+        b = wy_r8(p + i - 8);
+    }
+    a ^= wyp[1];
+    b ^= seed;
+    wy_mum(&a, &b);
+    return wy_mix(a ^ wyp[0] ^ len, b ^ wyp[1]);
+}
+
+static void intern_grow(Interner *in) {
+    size_t new_cap = in->cap ? in->cap * 2 : INTERN_INIT_CAP;
+    InternEntry **slots = (InternEntry **)calloc(new_cap, sizeof(*slots));
+    if (!slots) perr_exit("Failed to grow the intern table `%s`", strerror(errno));
+
+    for (size_t i = 0; i < in->cap; i++) {
+        InternEntry *e = in->slots[i];
+        if (!e) continue;
+        size_t j = e->hash & (new_cap - 1);
+        while (slots[j]) j = (j + 1) & (new_cap - 1);
+        slots[j] = e;
+    }
+
+    free(in->slots);
+    in->slots = slots;
+    in->cap = new_cap;
+}
+
+const char *intern(const char *s, size_t len) {
+    Interner *in = &interner;
+    if (!in->strings.head && arena_init(&in->strings, 64 * 1024) != 0) {
+        perr_exit("Failed to allocate the intern arena `%s`", strerror(errno));
+    }
+    // keep the load factor under 1/2
+    if ((in->count + 1) * 2 > in->cap) intern_grow(in);
+
+    uint64_t hash = intern_hash_bytes(s, len);
+    size_t i = hash & (in->cap - 1);
+    for (InternEntry *e; (e = in->slots[i]) != NULL; i = (i + 1) & (in->cap - 1)) {
+        if (e->hash == hash && e->len == len && memcmp(e->str, s, len) == 0) {
+            return e->str;
+        }
+    }
+
+    InternEntry *e = (InternEntry *)arena_alloc(&in->strings, sizeof(InternEntry) + len + 1);
+    if (!e) perr_exit("Failed to intern identifier `%s`", strerror(errno));
+    e->hash = hash;
+    e->len  = (uint32_t)len;
+    memcpy(e->str, s, len);
+    e->str[len] = '\0';
+
+    in->slots[i] = e;
+    in->count++;
+    return e->str;
+}
+
+const char *intern_cstr(const char *s) {
+    return intern(s, strlen(s));
+}
+
+void intern_deinit(void) {
+    free(interner.slots);
+    if (interner.strings.head) arena_deinit(&interner.strings);
+    interner = (Interner){0};
+    generation++;
+}
+
+uint32_t intern_generation(void) {
+    return generation;
+}
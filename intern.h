@@ -0,0 +1,43 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// Global identifier table. Every distinct name is stored once, so two
+// interned names are equal iff their pointers are equal. The returned
+// strings are NUL terminated and live until intern_deinit().
+// The hash of a name is computed once when it is interned (the lexer does
+// that for every T_IDENT) and stored in front of it, so wherever the name
+// travels, tokens, AST nodes, symbols, intern_hash() gets it with one load.
+// @NOTE: not thread safe.
+
+typedef struct {
+    uint64_t hash;
+    uint32_t len;
+    char str[];
+} InternEntry;
+
+const char *intern(const char *s, size_t len);
+const char *intern_cstr(const char *s);
+uint64_t intern_hash_bytes(const char *s, size_t len);
+void intern_deinit(void);
+// Starts at 1 and goes up with every intern_deinit(). Whoever keeps interned
+// names across calls (caches of names known up front) checks it, after a
+// deinit those pointers are gone even though the names come back.
+uint32_t intern_generation(void);
+
+static inline const InternEntry *intern_entry(const char *interned) {
+    return (const InternEntry *)(interned - offsetof(InternEntry, str));
+}
+
+static inline uint64_t intern_hash(const char *interned) {
+    return intern_entry(interned)->hash;
+}
+
+static inline size_t intern_len(const char *interned) {
+    return intern_entry(interned)->len;
+}
+
+#endif /* INTERN_H */
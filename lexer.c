@@ -1,10 +1,14 @@
 #include "lexer.h"
-#include <ctype.h>
-#include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
 #include "utils.h"
+#include "scan.h"
+#include "number.h"
+#include "source.h"
 
-static void write_to_sb(Rune *r, String_Builder *sb, char *rune_start) {
-    sb_appendf(sb, "%.*s", (int)r->width, rune_start);
+static inline void write_to_sb(Arena *a, Rune *r, String_Builder *sb, char *rune_start) {
+    arena_da_append_many(a, sb, rune_start, r->width);
 }
 
 Rune utf8_next(const unsigned char *s) {
@@ -33,77 +37,12 @@ Rune utf8_next(const unsigned char *s) {
     return r;
 }
 
-int is_uint(const char *s, uint64_t *res) {
-    char *end;
-    errno = 0;
-    int base = 10;
-
-    // Check for hex (0x), binary (0b), or octal (0o) prefix
-    if (s[0] == '0' && s[1] != '\0') {
-        if (s[1] == 'x' || s[1] == 'X') {
-            base = 16;
-            s += 2;
-        } else if (s[1] == 'b' || s[1] == 'B') {
-            base = 2;
-            s += 2;
-        } else if (s[1] == 'o' || s[1] == 'O') {
-            base = 8;
-            s += 2;
-        }
-    }
-
-    uint64_t val = strtoull(s, &end, base);
-    *res = val;
-    if (errno != 0) return 0;    // overflow
-    if (end == s) return 0;      // no digits
-    if (*end != '\0') return 0;  // junk at end
-    return 1;
-}
-
-int is_float(const char *s, double *res)
-{
-    char *end;
-    errno = 0;
-    double val = strtod(s, &end);
-
-    if (end == s) return 0;     // no conversion
-    if (*end != '\0') return 0; // leftover junk
-    if (!isfinite(val)) return 0; // check for overflow to inf
-
-    *res = val;
-    return 1;
-}
-
 char *peek(InternalCursor *cur, size_t n) {
     if (!cur || !cur->data) return NULL;
     if (cur->offset + n >= cur->data->count) return NULL;
     return cur->cursor + n;
 }
 
-static Rune next_rune(InternalCursor *cur) {
-    Rune r = {0};
-
-    if (!cur || cur->offset >= cur->data->count) {
-        return r;
-    }
-
-    unsigned char *s = (unsigned char *)cur->cursor;
-    r = utf8_next(s);
-
-    // newline check (ASCII only)
-    if (r.codepoint == '\n') {
-        cur->line++;
-        cur->col = 1;
-    } else {
-        cur->col++;
-    }
-
-    cur->cursor += r.width;
-    cur->offset += r.width;
-
-    return r;
-}
-
 /* @NOTE: will be DEPRECATED LATER */
 char *next(InternalCursor *cur) {
     if (!cur || !cur->data) return NULL;
@@ -111,13 +50,6 @@ char *next(InternalCursor *cur) {
 
     char *current = cur->cursor;
 
-    if (*current == '\n') {
-        cur->line++;
-        cur->col = 1;
-    } else {
-        cur->col++;
-    }
-
     cur->cursor++;
     cur->offset++;
 
@@ -130,543 +62,829 @@ bool peek_expect(InternalCursor *cur, size_t n, char expect) {
     return p && *p == expect;
 }
 
-char *flush_buffer(String_Builder *sb) {
-    if (sb->count == 0) return NULL;
+// Moves the cursor over `n` bytes.
+static inline void cursor_bump(InternalCursor *cur, size_t n) {
+    cur->cursor += n;
+    cur->offset += n;
+}
+
+// ---------------------------------------------------------------------------
+// Byte classes
+// ---------------------------------------------------------------------------
+
+typedef enum {
+    CC_IDENT = 0, // anything that is not listed below, including UTF-8 bytes
+    CC_DIGIT,
+    CC_EXP,       // e E
+    CC_SIGN,      // + -
+    CC_PUNCT,     // operators and delimiters
+    CC_QUOTE,     // "
+    CC_HASH,      // # comment
+    CC_SPACE,
+    CC_NUL,       // the driver NUL terminates the buffer, treat it as a separator
+    CC_COUNT,
+} CharClass;
+
+#define CC_RANGE(lo, hi) [lo ... hi]
+
+static const uint8_t char_class[256] = {
+    [0]             = CC_NUL,
+    ['\t']          = CC_SPACE,
+    ['\n']          = CC_SPACE,
+    ['\v']          = CC_SPACE,
+    ['\f']          = CC_SPACE,
+    ['\r']          = CC_SPACE,
+    [' ']           = CC_SPACE,
+    CC_RANGE('0', '9') = CC_DIGIT,
+    ['e']           = CC_EXP,
+    ['E']           = CC_EXP,
+    [PLUS_CHR]      = CC_SIGN,
+    [MIN_CHR]       = CC_SIGN,
+    [STRING_CHR]    = CC_QUOTE,
+    [COMMENT_CHR]   = CC_HASH,
+    [STAR_CHR]      = CC_PUNCT,
+    [DIV_CHR]       = CC_PUNCT,
+    [MOD_CHR]       = CC_PUNCT,
+    [COMMA_CHR]     = CC_PUNCT,
+    [CLOSING_CHR]   = CC_PUNCT,
+    [EQUAL_CHR]     = CC_PUNCT,
+    [OPARENT_CHR]   = CC_PUNCT,
+    [CPARENT_CHR]   = CC_PUNCT,
+    [OCPARENT_CHR]  = CC_PUNCT,
+    [CCPARENT_CHR]  = CC_PUNCT,
+    [OSPARENT_CHR]  = CC_PUNCT,
+    [CSPARENT_CHR]  = CC_PUNCT,
+    [COLON_CHR]     = CC_PUNCT,
+    [LESS_CHR]      = CC_PUNCT,
+    [GREATER_CHR]   = CC_PUNCT,
+    [BANG_CHR]      = CC_PUNCT,
+    [AMPERSAND_CHR] = CC_PUNCT,
+    [PIPE_CHR]      = CC_PUNCT,
+    [DOT_CHR]       = CC_PUNCT,
+    [CARET_CHR]     = CC_PUNCT,
+    [TILDE_CHR]     = CC_PUNCT,
+    [QUESTION_CHR]  = CC_PUNCT,
+    [AT_CHR]        = CC_PUNCT,
+    [DOLLAR_CHR]    = CC_PUNCT,
+};
+
+// Identifier lexeme DFA. A lexeme is a maximal run of ident bytes. Digit led
+// lexemes where number_parse() ran into ident bytes (1abc, 1e+x, 2.000e2x)
+// also come through here and swallow the sign of an exponent like the
+// numbers they resemble. They stop at a `.`, so what is left may be a number
+// on its own (the `2` of 2.000e2x) and is lexed as one, only the rest (1abc,
+// 0x1Fg) become identifiers.
+typedef enum {
+    LX_END = 0,
+    LX_IDENT,
+    LX_NUM,
+    LX_NUM_EXP, // number that just saw an `e`
+    LX_COUNT,
+} LexState;
+
+static const uint8_t lexeme_dfa[LX_COUNT][CC_COUNT] = {
+    [LX_IDENT]   = { [CC_IDENT] = LX_IDENT, [CC_DIGIT] = LX_IDENT, [CC_EXP] = LX_IDENT                        },
+    [LX_NUM]     = { [CC_IDENT] = LX_NUM,   [CC_DIGIT] = LX_NUM,   [CC_EXP] = LX_NUM_EXP                      },
+    [LX_NUM_EXP] = { [CC_IDENT] = LX_NUM,   [CC_DIGIT] = LX_NUM,   [CC_EXP] = LX_NUM_EXP, [CC_SIGN] = LX_NUM },
+};
+
+// Keyword classification. (first + last + 8 * len) & 63 is collision-free over
+// the *_STR keyword set, so an identifier costs one hash plus one memcmp. Adding
+// a keyword that collides trips -Woverride-init / -Winitializer-overrides below.
+#define KW_HASH(first, last, len) \
+    (((unsigned)(unsigned char)(first) + (unsigned)(unsigned char)(last) + 8u * (unsigned)(len)) & 63u)
+
+#define KW(str, first, last, kind) \
+    [KW_HASH(first, last, sizeof(str) - 1)] = { str, sizeof(str) - 1, kind }
+
+typedef struct {
+    const char *str;
+    size_t len;
+    TokenKind tk;
+} Keyword;
+
+static const Keyword keywords[64] = {
+    KW(LET_STR,      'l', 't', T_LET),
+    KW(CONST_STR,    'c', 't', T_CONST),
+    KW(FN_STR,       'f', 'n', T_FN),
+    KW(EXTERN_STR,   'e', 'n', T_EXTERN),
+    KW(CONTINUE_STR, 'c', 'e', T_CONTINUE),
+    KW(BREAK_STR,    'b', 'k', T_BREAK),
+    KW(IF_STR,       'i', 'f', T_IF),
+    KW(ELSE_STR,     'e', 'e', T_ELSE),
+    KW(FOR_STR,      'f', 'r', T_FOR),
+    KW(RETURN_STR,   'r', 'n', T_RETURN),
+    KW(TRUE_STR,     't', 'e', T_TRUE),
+    KW(FALSE_STR,    'f', 'e', T_FALSE),
+    KW(ENUM_STR,     'e', 'm', T_ENUM),
+    KW(TYPE_STR,     's', 't', T_TYPE),
+    KW(CAST_STR,     'c', 't', T_CAST),
+    KW(SIZEOF_STR,   's', 'f', T_SIZEOF),
+    KW(TYPEOF_STR,   't', 'f', T_TYPEOF),
+    KW(MATCH_STR,    'm', 'h', T_MATCH),
+    KW(IMPORT_STR,   'i', 't', T_IMPORT),
+    KW(DEFER_STR,    'd', 'r', T_DEFER),
+    KW(STATIC_STR,   's', 'c', T_STATIC),
+    /* KW(MUT_STR,      'm', 't', T_MUT), */
+};
+
+static inline const Keyword *lookup_keyword(const char *s, size_t len) {
+    if (len < 2 || len > 8) return NULL;
+    const Keyword *kw = &keywords[KW_HASH(s[0], s[len - 1], len)];
+    if (kw->len != len || memcmp(kw->str, s, len) != 0) return NULL;
+    return kw;
+}
 
-    char saved = sb->items[sb->count];
-    sb->items[sb->count] = '\0';
+// Operators, maximal munch. Every operator is its bytes packed into a key,
+// first byte lowest, and (key * OP_MUL) >> 24 is collision-free over the set
+// below, so the 1, 2 and 3 byte prefixes at the cursor cost one probe each
+// and the longest hit wins. Adding an operator is one more line, not more
+// branches in lexer_next(). If it collides it trips -Woverride-init /
+// -Winitializer-overrides, pick another odd OP_MUL then.
+#define OP_MUL 0x133f3b0bu
+
+#define OP_KEY(a, b, c) \
+    ((uint32_t)(unsigned char)(a) | (uint32_t)(unsigned char)(b) << 8 | (uint32_t)(unsigned char)(c) << 16)
+
+#define OP_HASH(key) ((uint32_t)((uint32_t)(key) * OP_MUL) >> 24)
+
+#define OP(a, b, c, len, kind) [OP_HASH(OP_KEY(a, b, c))] = { OP_KEY(a, b, c), len, kind }
+#define OP1(a, kind)       OP(a, 0, 0, 1, kind)
+#define OP2(a, b, kind)    OP(a, b, 0, 2, kind)
+#define OP3(a, b, c, kind) OP(a, b, c, 3, kind)
+
+typedef struct {
+    uint32_t key; // 0 for an empty slot
+    uint8_t len;
+    uint8_t tk;   // TokenKind
+} Operator;
+
+static const Operator operators[256] = {
+    OP1(PLUS_CHR,      T_PLUS),
+    OP1(MIN_CHR,       T_MIN),
+    OP1(STAR_CHR,      T_STAR),
+    OP1(DIV_CHR,       T_DIV),
+    OP1(MOD_CHR,       T_MOD),
+    OP1(CLOSING_CHR,   T_CLOSING),
+    OP1(EQUAL_CHR,     T_EQUAL),
+    OP1(OSPARENT_CHR,  T_OSPARENT),
+    OP1(CSPARENT_CHR,  T_CSPARENT),
+    OP1(OPARENT_CHR,   T_OPARENT),
+    OP1(CPARENT_CHR,   T_CPARENT),
+    OP1(OCPARENT_CHR,  T_OCPARENT),
+    OP1(CCPARENT_CHR,  T_CCPARENT),
+    OP1(COMMA_CHR,     T_COMMA),
+    OP1(COLON_CHR,     T_COLON),
+    OP1(LESS_CHR,      T_LT),
+    OP1(GREATER_CHR,   T_GT),
+    OP1(BANG_CHR,      T_NOT),
+    OP1(AMPERSAND_CHR, T_BIT_AND),
+    OP1(PIPE_CHR,      T_BIT_OR),
+    OP1(CARET_CHR,     T_BIT_XOR),
+    OP1(TILDE_CHR,     T_BIT_NOT),
+    OP1(DOT_CHR,       T_DOT),
+    OP1(QUESTION_CHR,  T_QUESTION),
+    OP1(AT_CHR,        T_AT),
+    OP1(DOLLAR_CHR,    T_DOLLAR),
+
+    OP2('+', '=', T_PLUS_EQ),
+    OP2('-', '=', T_MIN_EQ),
+    OP2('-', '>', T_ARROW),
+    OP2('*', '=', T_STAR_EQ),
+    OP2('/', '=', T_DIV_EQ),
+    OP2('%', '=', T_MOD_EQ),
+    OP2('=', '=', T_EQ),
+    OP2('=', '>', T_FATARROW),
+    OP2(':', ':', T_DCOLON),
+    OP2('<', '<', T_LSHIFT),
+    OP2('<', '=', T_LTE),
+    OP2('>', '>', T_RSHIFT),
+    OP2('>', '=', T_GTE),
+    OP2('!', '=', T_NEQ),
+    OP2('&', '&', T_AND),
+    OP2('&', '=', T_AND_EQ),
+    OP2('|', '|', T_OR),
+    OP2('|', '=', T_OR_EQ),
+    OP2('^', '=', T_XOR_EQ),
+    OP2('.', '.', T_DOTDOT),
+
+    OP3('<', '<', '=', T_LSHIFT_EQ),
+    OP3('>', '>', '=', T_RSHIFT_EQ),
+    OP3('.', '.', '.', T_DOTDOTDOT),
+};
+
+// The longest operator at the start of s[0, rem), NULL if there is none.
+static inline const Operator *lookup_operator(const char *s, size_t rem) {
+    // missing bytes read as 0, which no operator has
+    uint32_t k1 = (unsigned char)s[0];
+    uint32_t k2 = k1 | (rem > 1 ? (uint32_t)(unsigned char)s[1] << 8 : 0);
+    uint32_t k3 = k2 | (rem > 2 ? (uint32_t)(unsigned char)s[2] << 16 : 0);
+
+    const Operator *o1 = &operators[OP_HASH(k1)];
+    const Operator *o2 = &operators[OP_HASH(k2)];
+    const Operator *o3 = &operators[OP_HASH(k3)];
+    if (o3->key == k3) return o3;
+    if (o2->key == k2) return o2;
+    if (o1->key == k1) return o1;
+    return NULL;
+}
 
-    char *out = strdup(sb->items);
+inline static Token make_ident(Lexer *l, const char *text, size_t len, SrcLoc loc) {
+    Token n = { .loc = loc };
 
-    sb->items[sb->count] = saved;
-    sb->count = 0;
+    // keyword stuff
+    const Keyword *kw = lookup_keyword(text, len);
+    if (kw) {
+        n.tk = kw->tk;
+        return n;
+    }
 
-    return out;
+    n.tk = T_IDENT;
+    // the interner is not thread safe, chunks leave it to the merge step
+    if (l->chunk) n.data.Str = (Span){ (uint32_t)(text - l->source), (uint32_t)len };
+    else          n.data.Ident = intern(text, len);
+    return n;
 }
 
-inline static void make_ident_or_n(Tokens *t, String_Builder *sb, SrcLoc loc) {
-    if (sb->count == 0) return;
+// A failing chunk is lexed again by the merge step, which reports the error.
+#define lexer_error(l, loc, fmt, ...) \
+    do { if (!(l)->chunk) log_error(loc, fmt, ##__VA_ARGS__); } while (0)
 
-    char *tmp = flush_buffer(sb);
+// T_EOF sits on the NUL sentinel, not past it, so it reports a sane column.
+static uint32_t eof_offset(const Nob_String_Builder *data, size_t offset) {
+    if (offset > 0 && offset == data->count && data->items[offset - 1] == '\0') offset--;
+    return (uint32_t)offset;
+}
 
-    uint64_t ubuf = 0;
-    double fbuf   = 0.0;
+static Token lexer_eof(Lexer *l) {
+    l->done = true;
+    return (Token) {
+        .tk  = T_EOF,
+        .loc = (SrcLoc) { l->base + eof_offset(l->cur.data, l->cur.offset) },
+    };
+}
 
-    // keyword stuff
-    bool is_keyword = false;
-    Token n = {0};
-    n.loc = loc;
-    n.loc.col -= strlen(tmp);
-
-    if (strcmp(tmp, LET_STR) == 0) {
-        n.tk       = T_LET;
-        is_keyword = true;
-    } else if (strcmp(tmp, EXTERN_STR) == 0) {
-        n.tk       = T_EXTERN;
-        is_keyword = true;
-    } else if (strcmp(tmp, RETURN_STR) == 0) {
-        n.tk       = T_RETURN;
-        is_keyword = true;
-    } else if (strcmp(tmp, CONST_STR) == 0) {
-        n.tk       = T_CONST;
-        is_keyword = true;
-    } else if (strcmp(tmp, FN_STR) == 0) {
-        n.tk       = T_FN;
-        is_keyword = true;
-    } else if (strcmp(tmp, IF_STR) == 0) {
-        n.tk       = T_IF;
-        is_keyword = true;
-    } else if (strcmp(tmp, ELSE_STR) == 0) {
-        n.tk       = T_ELSE;
-        is_keyword = true;
-    } else if (strcmp(tmp, FOR_STR) == 0) {
-        n.tk       = T_FOR;
-        is_keyword = true;
-    } else if (strcmp(tmp, BREAK_STR) == 0) {
-        n.tk       = T_BREAK;
-        is_keyword = true;
-    } else if (strcmp(tmp, CONTINUE_STR) == 0) {
-        n.tk       = T_CONTINUE;
-        is_keyword = true;
-    } else if (strcmp(tmp, TRUE_STR) == 0) {
-        n.tk       = T_TRUE;
-        is_keyword = true;
-    } else if (strcmp(tmp, FALSE_STR) == 0) {
-        n.tk       = T_FALSE;
-        is_keyword = true;
-    } else if (strcmp(tmp, TYPE_STR) == 0) {
-        n.tk       = T_TYPE;
-        is_keyword = true;
-    } else if (strcmp(tmp, ENUM_STR) == 0) {
-        n.tk       = T_ENUM;
-        is_keyword = true;
-    } else if (strcmp(tmp, TYPE_STR) == 0) {
-        n.tk       = T_TYPE;
-        is_keyword = true;
-    } else if (strcmp(tmp, CAST_STR) == 0) {
-        n.tk       = T_CAST;
-        is_keyword = true;
-    } else if (strcmp(tmp, SIZEOF_STR) == 0) {
-        n.tk       = T_SIZEOF;
-        is_keyword = true;
-    } else if (strcmp(tmp, TYPEOF_STR) == 0) {
-        n.tk       = T_TYPEOF;
-        is_keyword = true;
-    } else if (strcmp(tmp, MATCH_STR) == 0) {
-        n.tk       = T_MATCH;
-        is_keyword = true;
-    } else if (strcmp(tmp, IMPORT_STR) == 0) {
-        n.tk       = T_IMPORT;
-        is_keyword = true;
-    } else if (strcmp(tmp, DEFER_STR) == 0) {
-        n.tk       = T_DEFER;
-        is_keyword = true;
-    } else if (strcmp(tmp, STATIC_STR) == 0) {
-        n.tk       = T_STATIC;
-        is_keyword = true;
-    /* } else if (strcmp(tmp, MUT_STR) == 0) { */
-    /*     n.tk       = T_MUT; */
-    /*     is_keyword = true; */
-    }
+static Token lexer_fail(Lexer *l) {
+    l->failed = true;
+    return lexer_eof(l);
+}
 
-    if (is_keyword) {
-        free(tmp);
-        da_append(t, n);
-        return;
+// T_NUM or T_FLO for the number_parse() result of `len` bytes at the cursor.
+static Token lex_number(Lexer *l, Token t, const Number *num, size_t len) {
+    InternalCursor *cur = &l->cur;
+    if (num->kind == NUM_RANGE) {
+        lexer_error(l, t.loc, "number literal `%.*s' is out of range", (int)len, cur->cursor);
+        return lexer_fail(l);
     }
-
-    if (is_uint(tmp, &ubuf)) {
-        Token n = {
-            .tk = T_NUM,
-            .loc = loc,
-        };
-        n.loc.col -= strlen(tmp);
-        n.data.Uint64 = ubuf;
-        da_append(t, n);
-    } else if (is_float(tmp, &fbuf)) {
-        Token n = {
-            .tk = T_FLO,
-            .loc = loc,
-        };
-        n.loc.col -= strlen(tmp);
-        n.data.F64 = fbuf;
-        da_append(t, n);
+    if (num->kind == NUM_INT) {
+        t.tk = T_NUM;
+        t.data.Uint64 = num->as.u;
     } else {
-        Token id = {
-            .tk = T_IDENT,
-            .loc = loc,
-        };
-        id.loc.col -= strlen(tmp);
-        id.data.String = tmp;
-        da_append(t, id);
-        return;
+        t.tk = T_FLO;
+        t.data.F64 = num->as.f;
     }
-
-    free(tmp);
+    cursor_bump(cur, len);
+    return t;
 }
 
-bool parse_tokens_v2(Nob_String_Builder *data, Tokens *tokens, const char *name) {
-    bool ret = true;
-    InternalCursor cur = {
-        .cursor = data->items,
-        .offset = 0,
-        .line = 1,
-        .col = 1,
-        .data = data,
+static void lexer_start(Lexer *l, Arena *a, Nob_String_Builder *data, uint32_t base, size_t offset) {
+    *l = (Lexer){
+        .cur = {
+            .cursor = data->items + offset,
+            .offset = offset,
+            .data = data,
+        },
+        .base = base,
+        .source = data->items,
+        .arena = a,
     };
+}
 
-    String_Builder sb = {0};
+bool lexer_init(Lexer *l, Arena *a, Nob_String_Builder *data, const char *name) {
+    uint32_t file = source_register(name, data->items, data->count);
+    if (file == SOURCE_NONE || !source_check_utf8(file, 0, data->count)) return false;
+    lexer_start(l, a, data, source_base(file), 0);
+    return true;
+}
 
-    while (cur.offset < data->count) {
-        size_t line = cur.line;
-        size_t col  = cur.col;
+Token lexer_next(Lexer *l) {
+    InternalCursor *cur = &l->cur;
+    const char *end = cur->data->items + cur->data->count;
 
-        Rune r = next_rune(&cur);
-        uint32_t ch = r.codepoint;
+    if (l->done) return lexer_eof(l);
 
-        /* // comment */
-        if (ch == COMMENT_CHR2 && peek_expect(&cur, 0, COMMENT_CHR2)) {
-            next_rune(&cur);
-            while (cur.offset < cur.data->count) {
-                Rune rr = next_rune(&cur);
-                if (rr.codepoint == '\n') break;
-            }
-            continue;
-        }
-        /* # comment */
-        if (ch == COMMENT_CHR) {
-            while (cur.offset < cur.data->count) {
-                Rune rr = next_rune(&cur);
-                if (rr.codepoint == '\n') break;
-            }
+    while (cur->offset < cur->data->count) {
+        unsigned char ch = (unsigned char)*cur->cursor;
+        uint8_t cls = char_class[ch];
+
+        // whitespace runs are skipped in bulk
+        if (cls == CC_SPACE) {
+            cursor_bump(cur, scan_whitespace(cur->cursor, cur->data->count - cur->offset));
             continue;
         }
-        SrcLoc currentloc = (SrcLoc){
-            .line  = line,
-            .col   = col,
-            .name  = name,
-        };
 
-        Token t = {};
+        SrcLoc currentloc = (SrcLoc){ l->base + (uint32_t)cur->offset };
+
+        Token t = {0};
         t.loc = currentloc;
 
-        switch (ch) {
-        case STAR_CHR:
-        case DIV_CHR:
-        case MOD_CHR:
-        case COMMA_CHR:
-        case STRING_CHR: // "
-        case CLOSING_CHR:
-        case EQUAL_CHR:
-        case OPARENT_CHR:
-        case CPARENT_CHR:
-        case OCPARENT_CHR:
-        case CCPARENT_CHR:
-        case OSPARENT_CHR:
-        case CSPARENT_CHR:
-        case COLON_CHR:
-        case LESS_CHR:
-        case GREATER_CHR:
-        case BANG_CHR:
-        case AMPERSAND_CHR:
-        case PIPE_CHR:
-        case DOT_CHR:
-        case CARET_CHR:
-        case TILDE_CHR:
-        case QUESTION_CHR:
-        case AT_CHR:
-        case DOLLAR_CHR:
-            if (sb.count > 0) { make_ident_or_n(tokens, &sb, currentloc); }
-            break;
-        default:
-            break;
-        }
+        switch (cls) {
+        case CC_NUL: {
+            cursor_bump(cur, 1);
+        } break;
+
+        case CC_HASH: {
+            /* # comment */
+            cursor_bump(cur, scan_newline(cur->cursor, cur->data->count - cur->offset));
+        } break;
+
+        case CC_DIGIT: {
+            Number num;
+            size_t len = number_parse(cur->cursor, (size_t)(end - cur->cursor), &num);
+            // a number glued to ident bytes (1abc, 0b12) goes by its lexeme below
+            if (len && (cur->cursor + len == end || char_class[(unsigned char)cur->cursor[len]] > CC_EXP)) {
+                return lex_number(l, t, &num, len);
+            }
+        } [[fallthrough]];
+
+        case CC_IDENT:
+        case CC_EXP: {
+            // Recognize the lexeme in place.
+            const char *p = cur->cursor;
+            uint8_t st = cls == CC_DIGIT ? LX_NUM : LX_IDENT;
+            while (p < end) {
+                st = lexeme_dfa[st][char_class[(unsigned char)*p]];
+                if (st == LX_END) break;
+                p++;
+            }
+            size_t len = (size_t)(p - cur->cursor);
+            if (cls == CC_DIGIT) {
+                Number num;
+                if (number_parse(cur->cursor, len, &num) == len) return lex_number(l, t, &num, len);
+            }
+            t = make_ident(l, cur->cursor, len, currentloc);
+            cursor_bump(cur, len);
+            return t;
+        } break;
+
+        case CC_QUOTE: {
+            cursor_bump(cur, 1);
+            // Escape-free literals stay a span of the source, the first
+            // backslash moves the literal over to `l->escaped`.
+            size_t body_start = cur->offset;
+            size_t esc_start  = 0;
+            bool escaped      = false;
+            String_Builder *esb = &l->escaped;
 
-        bool match = true;
-        switch (ch) {
-        case STRING_CHR: {
             while (true) {
-                if (cur.offset >= cur.data->count) {
-                    log_error(currentloc, "Unexpected EOF in string");
-                    return false;
+                // jump to the next '"', '\\' or '\n'
+                size_t run = scan_string_stop(cur->cursor, cur->data->count - cur->offset);
+                if (escaped) arena_da_append_many(l->arena, esb, cur->cursor, run);
+                cursor_bump(cur, run);
+
+                if (cur->offset >= cur->data->count) {
+                    lexer_error(l, currentloc, "Unexpected EOF in string");
+                    return lexer_fail(l);
                 }
 
-                char *rune_start = cur.cursor;
-                Rune sr = next_rune(&cur);
-                uint32_t sch = sr.codepoint;
+                // the scanner only stops on ASCII bytes
+                char *rune_start = cur->cursor;
+                char sch = *cur->cursor;
+                cursor_bump(cur, 1);
 
                 if (sch == STRING_CHR) break;
 
                 if (sch == '\n') {
-                    log_error(currentloc, "Unclosed string blocks");
-                    return false;
+                    lexer_error(l, currentloc, "Unclosed string blocks");
+                    return lexer_fail(l);
                 }
 
                 if (sch == '\\') {
-                    if (cur.offset >= cur.data->count) {
-                        log_error(currentloc, "Trailing backslash at EOF");
-                        return false;
+                    if (cur->offset >= cur->data->count) {
+                        lexer_error(l, currentloc, "Trailing backslash at EOF");
+                        return lexer_fail(l);
+                    }
+
+                    if (!escaped) {
+                        escaped   = true;
+                        esc_start = esb->count;
+                        arena_da_append_many(l->arena, esb, cur->data->items + body_start,
+                                             (size_t)(rune_start - cur->data->items) - body_start);
                     }
 
-                    Rune esc = next_rune(&cur);
+                    Rune esc = { .codepoint = (unsigned char)*cur->cursor, .width = 1 };
+                    if (esc.codepoint >= 0x80) esc = utf8_next((const unsigned char *)cur->cursor);
+                    cursor_bump(cur, esc.width);
                     switch (esc.codepoint) {
-                    case 'n':  sb_appendf(&sb, "\n"); break;
-                    case 't':  sb_appendf(&sb, "\t"); break;
-                    case 'r':  sb_appendf(&sb, "\r"); break;
-                    case '\\': sb_appendf(&sb, "\\"); break;
-                    case '"':  sb_appendf(&sb, "\""); break;
-                    case '0': {
-                        char zero = '\0';
-                        sb_appendf(&sb, "%c", zero);
-                    }  break;
+                    case 'n':  arena_da_append(l->arena, esb, '\n'); break;
+                    case 't':  arena_da_append(l->arena, esb, '\t'); break;
+                    case 'r':  arena_da_append(l->arena, esb, '\r'); break;
+                    case '\\': arena_da_append(l->arena, esb, '\\'); break;
+                    case '"':  arena_da_append(l->arena, esb, '"');  break;
+                    case '0':  arena_da_append(l->arena, esb, '\0'); break;
                     default:
-                        write_to_sb(&esc, &sb, cur.cursor - esc.width);
+                        write_to_sb(l->arena, &esc, esb, cur->cursor - esc.width);
                         break;
                     }
-                } else {
-                    write_to_sb(&sr, &sb, rune_start);
                 }
             }
 
             t.tk = T_STR;
-            t.data.String = flush_buffer(&sb);
-            da_append(tokens, t);
-            continue;
-        }
-        case PLUS_CHR:
-        case MIN_CHR: {
-            // Check for compound assignment (+=, -=)
-            char *next_char = peek(&cur, 0);
-            if (next_char && *next_char == EQUAL_CHR) {
-                next_rune(&cur);
-                t.tk = (ch == '+') ? T_PLUS_EQ : T_MIN_EQ;
-                da_append(tokens, t);
-                continue;
+            if (escaped) {
+                t.escaped  = true;
+                t.data.Str = (Span){ (uint32_t)esc_start, (uint32_t)(esb->count - esc_start) };
+            } else {
+                t.data.Str = (Span){ (uint32_t)body_start, (uint32_t)(cur->offset - 1 - body_start) };
             }
+            return t;
+        }
 
-            // Check for arrow (->)
-            if (next_char && *next_char == '>') {
-                next_rune(&cur);
-                t.tk = T_ARROW;
-                da_append(tokens, t);
+        case CC_SIGN:
+        case CC_PUNCT: {
+            /* // comment */
+            if (ch == COMMENT_CHR2 && peek_expect(cur, 1, COMMENT_CHR2)) {
+                cursor_bump(cur, scan_newline(cur->cursor, cur->data->count - cur->offset));
                 continue;
             }
 
-            // SCIENTIFIC NOTATION CHECK:
-            // @NOTE: only support ascii stuff here
-            if (sb.count > 0 && (toupper(sb.items[sb.count-1]) == 'E')) {
-                write_to_sb(&r, &sb, cur.cursor - r.width);
+            const Operator *op = lookup_operator(cur->cursor, cur->data->count - cur->offset);
+            if (op == NULL) {
+                cursor_bump(cur, 1);
                 continue;
             }
-
-            if (sb.count > 0) make_ident_or_n(tokens, &sb, currentloc);
-            t.tk = (ch == '+') ? T_PLUS : T_MIN;
-            da_append(tokens, t);
-            continue;
-        } break;
-        case STAR_CHR: {
-            // Check for *=
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_STAR_EQ;
-                next_rune(&cur);
-            } else {
-                t.tk = T_STAR;
-            }
-            da_append(tokens, t);
-            continue;
-        } break;
-        case DIV_CHR: {
-            // Check for /=
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_DIV_EQ;
-                next_rune(&cur);
-            } else {
-                t.tk = T_DIV;
-            }
-            da_append(tokens, t);
-            continue;
-        } break;
-        case MOD_CHR: {
-            // Check for %=
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_MOD_EQ;
-                next_rune(&cur);
-            } else {
-                t.tk = T_MOD;
-            }
-            da_append(tokens, t);
-        } break;
-        case CLOSING_CHR: {
-            t.tk = T_CLOSING;
-            da_append(tokens, t);
-        } break;
-        case EQUAL_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_EQ;
-                next_rune(&cur);
-            } else if (nc && *nc == '>') {
-                t.tk = T_FATARROW;
-                next_rune(&cur);
-            } else {
-                t.tk = T_EQUAL;
-            }
-            da_append(tokens, t);
-        } break;
-        case OSPARENT_CHR: {
-            t.tk = T_OSPARENT;
-            da_append(tokens, t);
-        } break;
-        case CSPARENT_CHR: {
-            t.tk = T_CSPARENT;
-            da_append(tokens, t);
-        } break;
-        case OPARENT_CHR: {
-            t.tk = T_OPARENT;
-            da_append(tokens, t);
-        } break;
-        case CPARENT_CHR: {
-            t.tk = T_CPARENT;
-            da_append(tokens, t);
-        } break;
-        case OCPARENT_CHR: {
-            t.tk = T_OCPARENT;
-            da_append(tokens, t);
-        } break;
-        case CCPARENT_CHR: {
-            t.tk = T_CCPARENT;
-            da_append(tokens, t);
-        } break;
-        case COMMA_CHR: {
-            t.tk = T_COMMA;
-            da_append(tokens, t);
-        } break;
-        case COLON_CHR: {
-            t.tk = T_COLON;
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == COLON_CHR) {
-                t.tk = T_DCOLON;
-                next_rune(&cur);
-            }
-            da_append(tokens, t);
-        } break;
-        case LESS_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == LESS_CHR) {
-                // Check for <<=
-                char *nc2 = peek(&cur, 1);
-                if (nc2 && *nc2 == EQUAL_CHR) {
-                    t.tk = T_LSHIFT_EQ;
-                    next_rune(&cur);
-                    next_rune(&cur);
-                } else {
-                    t.tk = T_LSHIFT;
-                    next_rune(&cur);
-                }
-            } else if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_LTE;
-                next_rune(&cur);
-            } else {
-                t.tk = T_LT;
-            }
-            da_append(tokens, t);
-        } break;
-        case GREATER_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == GREATER_CHR) {
-                // Check for >>=
-                char *nc2 = peek(&cur, 1);
-                if (nc2 && *nc2 == EQUAL_CHR) {
-                    t.tk = T_RSHIFT_EQ;
-                    next_rune(&cur);
-                    next_rune(&cur);
-                } else {
-                    t.tk = T_RSHIFT;
-                    next_rune(&cur);
-                }
-            } else if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_GTE;
-                next_rune(&cur);
-            } else {
-                t.tk = T_GT;
-            }
-            da_append(tokens, t);
-        } break;
-        case BANG_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_NEQ;
-                next_rune(&cur);
-            } else {
-                t.tk = T_NOT;
-            }
-            da_append(tokens, t);
-        } break;
-        case AMPERSAND_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == AMPERSAND_CHR) {
-                t.tk = T_AND;
-                next_rune(&cur);
-            } else if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_AND_EQ;
-                next_rune(&cur);
-            } else {
-                t.tk = T_BIT_AND;
-            }
-            da_append(tokens, t);
-        } break;
-        case PIPE_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == PIPE_CHR) {
-                t.tk = T_OR;
-                next_rune(&cur);
-            } else if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_OR_EQ;
-                next_rune(&cur);
-            } else {
-                t.tk = T_BIT_OR;
-            }
-            da_append(tokens, t);
-        } break;
-        case CARET_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == EQUAL_CHR) {
-                t.tk = T_XOR_EQ;
-                next_rune(&cur);
-            } else {
-                t.tk = T_BIT_XOR;
-            }
-            da_append(tokens, t);
-        } break;
-        case TILDE_CHR: {
-            t.tk = T_BIT_NOT;
-            da_append(tokens, t);
-        } break;
-        case DOT_CHR: {
-            char *nc = peek(&cur, 0);
-            if (nc && *nc == DOT_CHR) {
-                char *nc2 = peek(&cur, 1);
-                if (nc2 && *nc2 == DOT_CHR) {
-                    // ...
-                    t.tk = T_DOTDOTDOT;
-                    next_rune(&cur);
-                    next_rune(&cur);
-                } else {
-                    // ..
-                    t.tk = T_DOTDOT;
-                    next_rune(&cur);
-                }
-            } else {
-                t.tk = T_DOT;
-            }
-            da_append(tokens, t);
+            cursor_bump(cur, op->len);
+            t.tk = op->tk;
+            return t;
         } break;
-        case QUESTION_CHR: {
-            t.tk = T_QUESTION;
-            da_append(tokens, t);
-        } break;
-        case AT_CHR: {
-            t.tk = T_AT;
-            da_append(tokens, t);
-        } break;
-        case DOLLAR_CHR: {
-            t.tk = T_DOLLAR;
-            da_append(tokens, t);
-        } break;
-        default: { match = false; } break;
         }
+    }
 
-        if ((ch <= 127 && isspace(ch)) || match) {
-            if (sb.count > 0) make_ident_or_n(tokens, &sb, currentloc);
-            continue;
-        }
 
-        write_to_sb(&r, &sb, cur.cursor - r.width);
+    return lexer_eof(l);
+}
+
+// Appends the remaining tokens of `l`, T_EOF included, to tokens living in
+// the same arena.
+static bool lex_rest(Lexer *l, Tokens *tokens) {
+    // the escaped literals are handed over to the token array
+    l->escaped = tokens->escaped;
+
+    while (true) {
+        Token t = lexer_next(l);
+        arena_da_append(l->arena, tokens, t);
+        if (t.tk == T_EOF) break;
     }
 
-    /* NOTE: exhaust the last token */
-    if (sb.count > 0 && sb.items[0] != 0) {
-        make_ident_or_n(tokens, &sb, (SrcLoc) { name, (size_t)cur.line, (size_t)cur.col });
+    tokens->arena   = l->arena;
+    tokens->source  = l->source;
+    tokens->escaped = l->escaped;
+    return !l->failed;
+}
+
+bool parse_tokens_v2(Arena *a, Nob_String_Builder *data, Tokens *tokens, const char *name) {
+    Lexer l = {0};
+    if (!lexer_init(&l, a, data, name)) return false;
+    return lex_rest(&l, tokens);
+}
+
+// ---------------------------------------------------------------------------
+// Parallel lexing
+// ---------------------------------------------------------------------------
+
+#ifndef LEX_CHUNK_MIN
+#define LEX_CHUNK_MIN (256 * 1024)
+#endif
+
+// Chunks always start right after a '\n'. Comments end at the newline and
+// strings may only cross one through a `\<newline>` escape, so a chunk starts
+// inside a token only if the chunk before it failed on an unterminated string.
+typedef struct {
+    Nob_String_Builder view; // the whole source, cut off at the chunk end
+    size_t start;
+    Arena arena;             // per chunk, the merge copies out of it
+    struct {
+        Token *items;        // without the T_EOF
+        size_t count;
+        size_t capacity;
+    } tokens;
+    Nob_String_Builder escaped;
+    bool failed;
+} LexChunk;
+
+typedef struct {
+    LexChunk *chunks;
+    size_t count;
+    uint32_t base;
+    atomic_size_t next;
+} LexJob;
+
+static void lex_chunk(LexChunk *c, uint32_t base) {
+    // the merge lexes a failed chunk again sequentially
+    if (arena_init(&c->arena, 0) != 0) {
+        c->failed = true;
+        return;
+    }
+
+    Lexer l = {0};
+    lexer_start(&l, &c->arena, &c->view, base, c->start);
+    l.chunk = true;
+
+    while (true) {
+        Token t = lexer_next(&l);
+        if (t.tk == T_EOF) break;
+        arena_da_append(&c->arena, &c->tokens, t);
     }
 
-    Token teof = {
-        .tk   = T_EOF,
-        .loc = (SrcLoc) { name, cur.line, 1 },
+    c->failed  = l.failed;
+    c->escaped = l.escaped;
+}
+
+static void *lex_worker(void *arg) {
+    LexJob *job = arg;
+    while (true) {
+        size_t i = atomic_fetch_add(&job->next, 1);
+        if (i >= job->count) break;
+        lex_chunk(&job->chunks[i], job->base);
+    }
+    return NULL;
+}
+
+bool parse_tokens_parallel(Arena *a, Nob_String_Builder *data, Tokens *tokens, const char *name, size_t threads) {
+    if (threads == 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = n > 0 ? (size_t)n : 1;
+    }
+
+    // a few chunks per thread so one slow chunk does not stall the rest
+    size_t target = data->count / (threads * 4);
+    if (target < LEX_CHUNK_MIN) target = LEX_CHUNK_MIN;
+
+    struct {
+        LexChunk *items;
+        size_t count;
+        size_t capacity;
+    } chunks = {0};
+
+    for (size_t start = 0; start < data->count;) {
+        size_t end = start + target;
+        if (end >= data->count) {
+            end = data->count;
+        } else {
+            end += scan_newline(data->items + end, data->count - end) + 1;
+            if (end > data->count) end = data->count;
+        }
+        LexChunk c = {
+            .view  = { .items = data->items, .count = end },
+            .start = start,
+        };
+        da_append(&chunks, c);
+        start = end;
+    }
+
+    if (threads == 1 || chunks.count <= 1) {
+        da_free(chunks);
+        return parse_tokens_v2(a, data, tokens, name);
+    }
+
+    uint32_t file = source_register(name, data->items, data->count);
+    if (file == SOURCE_NONE || !source_check_utf8(file, 0, data->count)) {
+        da_free(chunks);
+        return false;
+    }
+    LexJob job = {
+        .chunks = chunks.items,
+        .count  = chunks.count,
+        .base   = source_base(file),
     };
-    da_append(tokens, teof);
+    if (threads > chunks.count) threads = chunks.count;
+
+    pthread_t *pool = malloc(sizeof(*pool) * threads);
+    size_t started = 0;
+    for (size_t i = 1; i < threads; i++) {
+        if (pthread_create(&pool[started], NULL, lex_worker, &job) != 0) break;
+        started++;
+    }
+    lex_worker(&job);
+    for (size_t i = 0; i < started; i++) pthread_join(pool[i], NULL);
+    free(pool);
+
+    // Merge in source order. Interning here keeps the intern table in the
+    // same order as a sequential run.
+    size_t total = tokens->count + 1;
+    for (size_t i = 0; i < chunks.count; i++) total += chunks.items[i].tokens.count;
+    arena_da_reserve(a, tokens, total);
+
+    bool ok = true;
+    size_t i = 0;
+    for (; i < chunks.count; i++) {
+        LexChunk *c = &chunks.items[i];
+        // lex the rest sequentially from here, it either errors for real or
+        // this chunk started inside a string
+        if (c->failed) break;
+
+        size_t esc_base = tokens->escaped.count;
+        for (size_t j = 0; j < c->tokens.count; j++) {
+            Token t = c->tokens.items[j];
+            if (t.tk == T_IDENT) {
+                t.data.Ident = intern(data->items + t.data.Str.offset, t.data.Str.len);
+            } else if (t.escaped) {
+                t.data.Str.offset += (uint32_t)esc_base;
+            }
+            tokens->items[tokens->count++] = t;
+        }
+        arena_da_append_many(a, &tokens->escaped, c->escaped.items, c->escaped.count);
+    }
+
+    if (i < chunks.count) {
+        Lexer l = {0};
+        lexer_start(&l, a, data, job.base, chunks.items[i].start);
+        ok = lex_rest(&l, tokens);
+    } else {
+        Token eof = {
+            .tk  = T_EOF,
+            .loc = (SrcLoc) { job.base + eof_offset(data, data->count) },
+        };
+        tokens->items[tokens->count++] = eof;
+        tokens->arena  = a;
+        tokens->source = data->items;
+    }
 
-    da_free(sb);
-    return ret;
+    for (size_t j = 0; j < chunks.count; j++) arena_deinit(&chunks.items[j].arena);
+    da_free(chunks);
+    return ok;
 }
 
-void tokens_deinit(Tokens *t) {
-    for (size_t i = 0; i < t->count; i++) {
-        Token current = t->items[i];
-        if (current.tk == T_IDENT || current.tk == T_STR) {
-            if (current.data.String) free(current.data.String);
+// ---------------------------------------------------------------------------
+// Incremental relexing
+// ---------------------------------------------------------------------------
+
+// Moves the locations of tokens[from, to) by `loc_delta` and the source
+// spans of their unescaped string literals by `text_delta`.
+static void tokens_shift(Tokens *tokens, size_t from, size_t to, int64_t loc_delta, int64_t text_delta) {
+    if (loc_delta == 0 && text_delta == 0) return;
+    for (size_t i = from; i < to; i++) {
+        Token *t = &tokens->items[i];
+        t->loc.offset = (uint32_t)((int64_t)t->loc.offset + loc_delta);
+        if (t->tk == T_STR && !t->escaped) {
+            t->data.Str.offset = (uint32_t)((int64_t)t->data.Str.offset + text_delta);
         }
     }
 }
+
+bool tokens_relex(Tokens *tokens, Nob_String_Builder *data, const char *name,
+                  size_t start, size_t old_len, const char *text, size_t len) {
+    assert(tokens->count > 0 && tokens->items[tokens->count - 1].tk == T_EOF);
+    assert(start + old_len <= data->count);
+
+    size_t new_count = data->count - old_len + len;
+    if (new_count > UINT32_MAX) {
+        perr("`%s' is too big, spans only address 4 GiB of source", name);
+        return false;
+    }
+
+    // Token offsets below are global, `base` turns file offsets into them.
+    uint32_t file = source_register(name, data->items, data->count);
+    if (file == SOURCE_NONE) return false;
+    uint32_t base = source_base(file);
+
+    // First token at or after the edit.
+    size_t lo = 0, hi = tokens->count - 1;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (tokens->items[mid].loc.offset - base < start) lo = mid + 1;
+        else                                          hi = mid;
+    }
+    // Number lexing may look far past the token it produces (number_parse()
+    // reads `2.000e2` of `2.000e2x` before the `x` turns it into the number
+    // `2`, `.` and the identifier `000e2x`), but never past a newline, and
+    // only a string literal can start on an earlier line. So restart at the first token on the line
+    // of the token before the edit. Near the top just start over, only
+    // whitespace precedes the first token.
+    size_t first = lo > 0 ? lo - 1 : 0;
+    size_t line_start = tokens->items[first].loc.offset - base;
+    while (line_start > 0 && data->items[line_start - 1] != '\n') line_start--;
+    while (first > 0 && tokens->items[first - 1].loc.offset - base >= line_start) first--;
+    size_t from = first > 0 ? tokens->items[first].loc.offset - base : 0;
+
+    String_Builder replaced = {0};
+    if (old_len) sb_append_buf(&replaced, data->items + start, old_len);
+    size_t old_count = data->count;
+
+    da_reserve(data, new_count);
+    memmove(data->items + start + len, data->items + start + old_len, data->count - start - old_len);
+    memcpy(data->items + start, text, len);
+    data->count = new_count;
+
+    // Only sequences touching the edit can be ill-formed now. Check from
+    // the last sequence start before it to past the continuation bytes after
+    // it, and put the old bytes back if the edit broke the source.
+    file = source_register(name, data->items, data->count);
+    size_t check_from = start > 3 ? start - 3 : 0;
+    while (check_from < start && ((unsigned char)data->items[check_from] & 0xC0) == 0x80) check_from++;
+    size_t check_to = start + len;
+    while (check_to < data->count && check_to < start + len + 3 &&
+           ((unsigned char)data->items[check_to] & 0xC0) == 0x80) check_to++;
+    if (file == SOURCE_NONE || !source_check_utf8(file, check_from, check_to)) {
+        memmove(data->items + start + old_len, data->items + start + len, data->count - start - len);
+        if (old_len) memcpy(data->items + start, replaced.items, old_len);
+        data->count = old_count;
+        // the grown text may have moved the file, the tokens move with it
+        file = source_register(name, data->items, data->count);
+        tokens_shift(tokens, 0, tokens->count, (int64_t)source_base(file) - base, 0);
+        tokens->source = data->items;
+        da_free(replaced);
+        return false;
+    }
+    da_free(replaced);
+    uint32_t new_base = source_base(file);
+
+    Lexer l = {0};
+    lexer_start(&l, tokens->arena, data, new_base, from);
+    l.escaped = tokens->escaped;
+
+    // Old tokens past the edit. Once a new token starts where one of them
+    // starts after shifting, the rest of the input is the same bytes lexed
+    // from the same state, so the old tokens can be kept.
+    int64_t delta = (int64_t)len - (int64_t)old_len;
+    int64_t moved = (int64_t)new_base - (int64_t)base;
+    size_t old_end = start + old_len;
+    size_t new_end = new_base + start + len;
+    size_t last = tokens->count - 1; // the old T_EOF, never used for syncing
+    size_t j = lo;
+    while (j < last && tokens->items[j].loc.offset - base < old_end) j++;
+
+    struct {
+        Token *items;
+        size_t count;
+        size_t capacity;
+    } fresh = {0};
+    bool synced = false;
+    while (true) {
+        Token t = lexer_next(&l);
+        if (t.tk != T_EOF && t.loc.offset >= new_end) {
+            while (j < last && (int64_t)tokens->items[j].loc.offset + moved + delta < (int64_t)t.loc.offset) j++;
+            if (j < last && (int64_t)tokens->items[j].loc.offset + moved + delta == (int64_t)t.loc.offset) {
+                synced = true;
+                break;
+            }
+        }
+        da_append(&fresh, t);
+        if (t.tk == T_EOF) break;
+    }
+    if (!synced) j = tokens->count;
+
+    size_t tail = tokens->count - j;
+    size_t total = first + fresh.count + tail;
+    arena_da_reserve(tokens->arena, tokens, total);
+    if (first + fresh.count != j) {
+        memmove(tokens->items + first + fresh.count, tokens->items + j, tail * sizeof(Token));
+    }
+    if (fresh.count) memcpy(tokens->items + first, fresh.items, fresh.count * sizeof(Token));
+    tokens->count = total;
+
+    // the kept tokens only move
+    tokens_shift(tokens, 0, first, moved, 0);
+    tokens_shift(tokens, first + fresh.count, total, moved + delta, delta);
+
+    tokens->source  = data->items;
+    tokens->escaped = l.escaped;
+    da_free(fresh);
+    return !l.failed;
+}
+
+// ---------------------------------------------------------------------------
+// Packed tokens
+// ---------------------------------------------------------------------------
+
+static void packed_push(PackedTokens *pt, const Token *t) {
+    if (pt->count == pt->capacity) {
+        size_t cap   = pt->capacity ? pt->capacity * 2 : ARENA_DA_INIT_CAP;
+        pt->kinds    = (uint8_t *)arena_realloc(pt->arena, pt->kinds, pt->capacity * sizeof(*pt->kinds),
+                                                cap * sizeof(*pt->kinds));
+        pt->offsets  = (uint32_t *)arena_realloc(pt->arena, pt->offsets, pt->capacity * sizeof(*pt->offsets),
+                                                 cap * sizeof(*pt->offsets));
+        pt->capacity = cap;
+        assert(pt->kinds && pt->offsets && "Buy more RAM lool!!");
+    }
+    pt->kinds[pt->count]   = (uint8_t)(t->tk | (t->escaped ? PACKED_ESCAPED : 0));
+    pt->offsets[pt->count] = t->loc.offset;
+    pt->count++;
+    if (token_has_data(t->tk)) arena_da_append(pt->arena, &pt->payload, t->data);
+}
+
+bool parse_tokens_packed(Arena *a, Nob_String_Builder *data, PackedTokens *pt, const char *name) {
+    Lexer l = {0};
+    if (!lexer_init(&l, a, data, name)) return false;
+    pt->arena = a;
+    l.escaped = pt->escaped;
+
+    while (true) {
+        Token t = lexer_next(&l);
+        packed_push(pt, &t);
+        if (t.tk == T_EOF) break;
+    }
+
+    pt->source  = data->items;
+    pt->escaped = l.escaped;
+    return !l.failed;
+}
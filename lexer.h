@@ -6,6 +6,8 @@
 #define NOB_STRIP_PREFIX
 #include "nob.h"
 #include "utils.h"
+#include "intern.h"
+#include "arena.h"
 
 #define LET_STR "let"
 #define CONST_STR "const"
@@ -248,32 +250,155 @@ static inline const char *get_token_str(TokenKind tk) {
 }
 
 
+// Byte range of a string literal. Points into `Tokens.source`, or into
+// `Tokens.escaped` when the token is flagged `escaped`.
+typedef struct {
+    uint32_t offset;
+    uint32_t len;
+} Span;
+
+typedef union {
+    char        Char;
+    uint64_t    Uint64; // i will just save it as the biggest for now will be handled later.
+    double      F64;    // i will just save it as the biggest for now will be handled later.
+    Span        Str;    // T_STR
+    const char *Ident;  // T_IDENT, interned
+} TokenData;
+
 typedef struct {
     TokenKind tk;
-    union {
-        char     Char;
-        uint64_t Uint64; // i will just save it as the biggest for now will be handled later.
-        double   F64;    // i will just save it as the biggest for now will be handled later.
-        char    *String;
-    } data;
-    SrcLoc loc;
+    bool escaped; // T_STR only, the unescaped text was materialized.
+    TokenData data;
+    SrcLoc loc;   // global offset, data.Str holds the offset in the source
 } Token;
 
+// The token array and the escaped literals live in `arena`, freeing that
+// arena frees the tokens.
 typedef struct {
     Token *items;
     size_t count;
     size_t capacity;
+    Arena *arena;
+    const char *source;            // must outlive the tokens
+    Nob_String_Builder escaped;    // string literals that contained escapes
 } Tokens;
 
+// T_IDENT .. T_FLO, keep them last in TokenKind
+static inline bool token_has_data(TokenKind tk) {
+    return tk >= T_IDENT;
+}
+
+#define PACKED_ESCAPED 0x80 // or'ed into `kinds` for an escaped T_STR
+_Static_assert(T_FLO < PACKED_ESCAPED, "TokenKind must fit in 7 bits");
+
+// Struct of arrays token stream, about 8 bytes per token instead of
+// sizeof(Token). Only tokens with token_has_data() take a `payload` slot,
+// in token order, so PackedReader finds them by counting.
+typedef struct {
+    uint8_t *kinds;
+    uint32_t *offsets;             // loc.offset of every token
+    size_t count;
+    size_t capacity;
+    struct {
+        TokenData *items;
+        size_t count;
+        size_t capacity;
+    } payload;
+    Arena *arena;                  // owns every array above and `escaped`
+    const char *source;            // must outlive the tokens
+    Nob_String_Builder escaped;    // string literals that contained escapes
+} PackedTokens;
+
+// Decodes single tokens of a PackedTokens into full Tokens. It keeps a
+// cursor, so walking forward (even skipping tokens) costs O(1) per token.
+typedef struct {
+    const PackedTokens *pt;
+    size_t index;        // `payload` is the payload slot of token `index`
+    size_t payload;
+} PackedReader;
+
 typedef struct {
-    size_t line, col;
     char *cursor;
     size_t offset;
     Nob_String_Builder *data;
 } InternalCursor;
 
+// Pull based lexer, every lexer_next() call scans exactly one token.
+// After the T_EOF token it keeps returning T_EOF; `failed` tells an error
+// (already reported) apart from the real end of the input.
+typedef struct {
+    InternalCursor cur;
+    uint32_t base; // global offset of the file, see source_register()
+    const char *source;
+    Arena *arena;
+    Nob_String_Builder escaped; // string literals that contained escapes, in `arena`
+    bool done;
+    bool failed;
+    // Lexing one chunk for parse_tokens_parallel(): errors are not printed
+    // and T_IDENT tokens carry a Span in data.Str until the merge interns them.
+    bool chunk;
+} Lexer;
+
+static inline Nob_String_View token_text_in(const char *source, const Nob_String_Builder *escaped, const Token *tok) {
+    if (tok->tk == T_IDENT) return nob_sv_from_parts(tok->data.Ident, intern_len(tok->data.Ident));
+    const char *base = tok->escaped ? escaped->items : source;
+    return nob_sv_from_parts(base + tok->data.Str.offset, tok->data.Str.len);
+}
+
+static inline Nob_String_View token_text(const Tokens *t, const Token *tok) {
+    return token_text_in(t->source, &t->escaped, tok);
+}
+
+static inline Nob_String_View lexer_token_text(const Lexer *l, const Token *tok) {
+    return token_text_in(l->source, &l->escaped, tok);
+}
+
+static inline Nob_String_View packed_token_text(const PackedTokens *pt, const Token *tok) {
+    return token_text_in(pt->source, &pt->escaped, tok);
+}
+
+// Decodes one codepoint without any checks, lexer_init() validates the
+// whole source up front so the lexer never sees ill-formed UTF-8.
 Rune utf8_next(const unsigned char *s);
-bool parse_tokens_v2(Nob_String_Builder *data, Tokens *t, const char *name);
-void tokens_deinit(Tokens *t);
+bool lexer_init(Lexer *l, Arena *a, Nob_String_Builder *data, const char *name);
+Token lexer_next(Lexer *l);
+bool parse_tokens_v2(Arena *a, Nob_String_Builder *data, Tokens *t, const char *name);
+// Same tokens as parse_tokens_v2, but the source is cut at newlines into
+// chunks that are lexed on `threads` threads (0 = one per online CPU).
+bool parse_tokens_parallel(Arena *a, Nob_String_Builder *data, Tokens *t, const char *name, size_t threads);
+// Replaces data[start, start + old_len) with `text` and patches `t`, which
+// was lexed from `data` before the edit, into what a full relex would give.
+// Only the tokens around the edit are lexed again, the rest are shifted.
+// An edit that leaves ill-formed UTF-8 behind is reported and not applied.
+// @NOTE: `data` must be growable (not a SourceFile). Escaped copies
+//        of replaced string literals stay in t->escaped, and outgrown token
+//        arrays in t->arena, until the arena goes.
+bool tokens_relex(Tokens *t, Nob_String_Builder *data, const char *name,
+                  size_t start, size_t old_len, const char *text, size_t len);
+
+bool parse_tokens_packed(Arena *a, Nob_String_Builder *data, PackedTokens *pt, const char *name);
+
+static inline void packed_reader_init(PackedReader *r, const PackedTokens *pt) {
+    *r = (PackedReader){ .pt = pt };
+}
+
+// Token i, or the T_EOF past the end. Going backwards is supported but
+// rescans the distance, the parser only ever looks one token back.
+static inline Token packed_get(PackedReader *r, size_t i) {
+    const PackedTokens *pt = r->pt;
+    if (i >= pt->count) i = pt->count - 1;
+
+    while (r->index < i) r->payload += token_has_data(pt->kinds[r->index++] & ~PACKED_ESCAPED);
+    while (r->index > i) r->payload -= token_has_data(pt->kinds[--r->index] & ~PACKED_ESCAPED);
+
+    uint8_t kind = pt->kinds[i];
+    Token t = {
+        .tk      = kind & ~PACKED_ESCAPED,
+        .escaped = (kind & PACKED_ESCAPED) != 0,
+        .loc     = { pt->offsets[i] },
+    };
+    if (token_has_data(t.tk)) t.data = pt->payload.items[r->payload];
+    return t;
+}
 
 #endif
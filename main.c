@@ -6,17 +6,20 @@
 #include "lexer.h"
 #include "ast.h"
 #include "semantic.h"
+#include "source.h"
 
 [[maybe_unused]] static inline void print_token(Tokens *tokens) {
     for (size_t i = 0; i < tokens->count; i++) {
         Token *tok = &tokens->items[i];
-        printf("%s:%lu:%lu: %s :: ", tok->loc.name, tok->loc.line, tok->loc.col, get_token_str(tok->tk));
+        SrcPos pos = srcloc_resolve(tok->loc);
+        printf("%s:%lu:%lu: %s :: ", pos.name, pos.line, pos.col, get_token_str(tok->tk));
 
         switch (tok->tk) {
         case T_IDENT:
-        case T_STR:
-            printf("%s", tok->data.String);
-            break;
+        case T_STR: {
+            String_View sv = token_text(tokens, tok);
+            printf(SV_Fmt, SV_Arg(sv));
+        } break;
         case T_NUM:
             printf("%lu", tok->data.Uint64);
             break;
@@ -32,60 +35,135 @@
     }
 }
 
-int main(int argc, char **argv) {
-    if (argc <= 1) perr_exit("Not enought args");
-
-    shift(argv, argc);
-    const char *file = argv[0];
-    String_Builder sb = {0};
-
-    if (!read_entire_file(file, &sb))
-        return 1;
-    if (sb.count <= 1) perr_exit("Empty file");
-    sb_append_null(&sb);
-
-    Arena rarena = {0};
-    if (arena_init(&rarena, ARENA_DEFAULT_SIZE) != 0) {
-        perr_exit("Failed to allocate the runtime stack arena `%s`", strerror(errno));
+typedef enum {
+    MODE_TOKENS,   // build the token array, then the AST
+    MODE_STREAM,   // lex while parsing instead of building the token array first
+    MODE_PARALLEL, // lex the token array and parse it on every CPU
+    MODE_PACKED,   // lex into the struct of arrays token stream
+} Mode;
+
+// Lexes and parses one file, appending its top level statements to `program`.
+static bool process_file(Mode mode, SourceFile *src, Ast *ast, Arena *tarena,
+                         Statements *program, double *total_time) {
+    long long start, end;
+    double elapsed_ms;
+
+    if (mode == MODE_STREAM) {
+        // == TOKENIZING + AST-ING
+        Lexer lexer = {0};
+        if (!lexer_init(&lexer, tarena, &src->text, src->name)) return false;
+
+        start = current_time_ns();
+        if (!make_ast_stream(ast, program, &lexer)) return false;
+        end = current_time_ns();
+        elapsed_ms = (double)(end - start) / 1e6;
+        *total_time += elapsed_ms;
+        printf("Token + AST parsing took : %.3f ms\n", elapsed_ms);
+        return true;
     }
 
-    printf("Processing file `%s'...\n", file);
-    double total_time = 0.0;
+    if (mode == MODE_PACKED) {
+        // == TOKENIZING
+        PackedTokens ptokens = {0};
+        start = current_time_ns();
+        if (!parse_tokens_packed(tarena, &src->text, &ptokens, src->name)) return false;
+        end = current_time_ns();
+        elapsed_ms = (double)(end - start) / 1e6;
+        *total_time += elapsed_ms;
+        printf("Token parsing took     : %.3f ms (%zu tokens)\n", elapsed_ms, ptokens.count);
+
+        // == AST-ING
+        start = current_time_ns();
+        if (!make_ast_packed(ast, program, &ptokens)) return false;
+        end = current_time_ns();
+        elapsed_ms = (double)(end - start) / 1e6;
+        *total_time += elapsed_ms;
+        printf("AST parsing took       : %.3f ms\n", elapsed_ms);
+        return true;
+    }
 
     // == TOKENIZING
     Tokens tokens = {0};
-
-    long long start = current_time_ns();
-    bool res = parse_tokens_v2(&sb, &tokens, file);
-    long long end = current_time_ns();
+    start = current_time_ns();
+    bool res = mode == MODE_PARALLEL ? parse_tokens_parallel(tarena, &src->text, &tokens, src->name, 0)
+                                     : parse_tokens_v2(tarena, &src->text, &tokens, src->name);
+    end = current_time_ns();
 
     if (!res) {
-        goto cleanup;
+        return false;
     }
 
-    double elapsed_ms = (double)(end - start) / 1e6;
-    total_time += elapsed_ms;
-    printf("Token parsing took     : %.3f ms\n", elapsed_ms);
+    elapsed_ms = (double)(end - start) / 1e6;
+    *total_time += elapsed_ms;
+    printf("Token parsing took     : %.3f ms (%zu tokens)\n", elapsed_ms, tokens.count);
 
     /* print_token(&tokens); */
 
 
     // == AST-ING
-    Statements program = {0};
     start = current_time_ns();
-    if (!make_ast(&rarena, &program, &tokens)) { goto cleanup; }
+    res = mode == MODE_PARALLEL ? make_ast_parallel(ast, program, &tokens, 0)
+                                : make_ast(ast, program, &tokens);
     end = current_time_ns();
+    if (!res) return false;
     elapsed_ms = (double)(end - start) / 1e6;
-    total_time += elapsed_ms;
+    *total_time += elapsed_ms;
     printf("AST parsing took       : %.3f ms\n", elapsed_ms);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    if (argc <= 1) perr_exit("Not enought args");
+
+    shift(argv, argc);
+
+    Mode mode = MODE_TOKENS;
+    while (argc > 0 && argv[0][0] == '-' && argv[0][1] != '\0') {
+        if (strcmp(argv[0], "-stream") == 0)        mode = MODE_STREAM;
+        else if (strcmp(argv[0], "-parallel") == 0) mode = MODE_PARALLEL;
+        else if (strcmp(argv[0], "-packed") == 0)   mode = MODE_PACKED;
+        else perr_exit("Unknown flag `%s'", argv[0]);
+        shift(argv, argc);
+    }
+    if (argc <= 0) perr_exit("Not enought args");
+
+    Arena rarena = {0};
+    if (arena_init(&rarena, ARENA_DEFAULT_SIZE) != 0) {
+        perr_exit("Failed to allocate the runtime stack arena `%s`", strerror(errno));
+    }
+
+    // tokens and escaped string literals, dropped in one go at the end
+    Arena tarena = {0};
+    if (arena_init(&tarena, ARENA_DEFAULT_SIZE) != 0) {
+        perr_exit("Failed to allocate the token arena `%s`", strerror(errno));
+    }
+
+    double total_time = 0.0;
+    Ast ast = {0};
+    ast_init(&ast, &rarena);
+    Statements program = {0};
+    long long start, end;
+    double elapsed_ms;
+
+    // Every file goes into one program, so the semantic passes see the top
+    // level declarations of all of them.
+    for (int i = 0; i < argc; i++) {
+        SourceFile *src = source_open(argv[i]);
+        if (src == NULL) goto cleanup;
+        if (src->text.count <= 1) perr_exit("Empty file `%s'", argv[i]);
+
+        printf("Processing file `%s'...\n", argv[i]);
+        if (!process_file(mode, src, &ast, &tarena, &program, &total_time)) goto cleanup;
+    }
 
     /* for (size_t i = 0; i < program.count; i++) { */
-    /*     print_stmt(program.items[i], 0); */
+    /*     print_stmt(&ast, program.items[i], 0); */
     /* } */
 
     // == SEMANTIC CHECKING
     Semantic semantic = {0};
     semantic.arena = &rarena;
+    semantic.ast = &ast;
 
     start = current_time_ns();
     if (!semantic_check_pass_one(&semantic, &program))   goto cleanup;
@@ -102,7 +180,8 @@ int main(int argc, char **argv) {
 
  cleanup:
     arena_deinit(&rarena);
-    tokens_deinit(&tokens);
-    da_free(tokens);
+    arena_deinit(&tarena);
+    source_manager_free();
+    intern_deinit();
    return 0;
 }
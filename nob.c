@@ -1,6 +1,8 @@
 #define NOB_IMPLEMENTATION
 #define NOB_STRIP_PREFIX
 #define PROG_NAME "sawit"
+#define BENCH_NAME "sawit_bench"
+#define GEN_NAME "sawit_gen"
 #include "nob.h"
 
 static Cmd cmd = {0};
@@ -11,19 +13,67 @@ static void cflags(Cmd *cmd) {
     /* cmd_append(cmd, "-O2"); */
     /* cmd_append(cmd, "-march=native"); */
     cmd_append(cmd, "-ggdb");
+    cmd_append(cmd, "-pthread");
+}
+
+// everything but main.c, shared by the compiler and sawit_bench
+static const char *lib_sources[] = {
+    "nob_inc.c",
+    "intern.c",
+    "scan.c",
+    "source.c",
+    "number.c",
+    "lexer.c",
+    "semantic.c",
+    "ast.c",
+};
+
+static void sources(Cmd *cmd) {
+    for (size_t i = 0; i < ARRAY_LEN(lib_sources); i++) {
+        cmd_append(cmd, lib_sources[i]);
+    }
+}
+
+// Builds an optimized helper binary out of `main_source` and runs it with
+// the rest of the command line. `./nob bench [ARGS...]` and
+// `./nob gen [ARGS...]`, see bench.c and gen.c for the ARGS.
+static bool tool(const char *name, const char *main_source, bool with_lib, int argc, char **argv) {
+    cmd_append(&cmd, "clang");
+    cflags(&cmd);
+    cmd_append(&cmd, "-O2");
+    cmd_append(&cmd, "-o", name);
+    if (with_lib) sources(&cmd);
+    else          cmd_append(&cmd, "nob_inc.c");
+    cmd_append(&cmd, main_source);
+    if (!cmd_run(&cmd)) return false;
+
+    cmd_append(&cmd, temp_sprintf("./%s", name));
+    for (int i = 0; i < argc; i++) {
+        cmd_append(&cmd, argv[i]);
+    }
+    return cmd_run(&cmd);
 }
 
 int main(int argc, char **argv) {
     NOB_GO_REBUILD_URSELF(argc, argv);
 
+    if (argc >= 2 && strcmp(argv[1], "bench") == 0) {
+        shift(argv, argc);
+        shift(argv, argc);
+        return tool(BENCH_NAME, "bench.c", true, argc, argv) ? 0 : 1;
+    }
+
+    if (argc >= 2 && strcmp(argv[1], "gen") == 0) {
+        shift(argv, argc);
+        shift(argv, argc);
+        return tool(GEN_NAME, "gen.c", false, argc, argv) ? 0 : 1;
+    }
+
     /* cmd_append(&cmd, "cc"); */
     cmd_append(&cmd, "clang");
     cflags(&cmd);
     cmd_append(&cmd, "-o", PROG_NAME);
-    cmd_append(&cmd, "nob_inc.c");
-    cmd_append(&cmd, "lexer.c");
-    cmd_append(&cmd, "semantic.c");
-    cmd_append(&cmd, "ast.c");
+    sources(&cmd);
     cmd_append(&cmd, "main.c");
 
     if (!cmd_run(&cmd)) return 1;
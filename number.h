@@ -0,0 +1,34 @@
+#ifndef NUMBER_H
+#define NUMBER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Numeric literal scanner used by the lexer. Accepted forms:
+//   123   0x1F   0b1010   0o17      integers (prefix case insensitive)
+//   1.5   2.000e2   1e-5   3E+8     floats
+// Decimal integers that do not fit in 64 bits become floats, like before.
+// Floats are converted with Eisel-Lemire and fall back to strtod when that
+// can not decide the rounding.
+
+typedef enum {
+    NUM_NONE = 0, // s does not start with a number
+    NUM_INT,
+    NUM_FLOAT,
+    NUM_RANGE,    // well formed but does not fit (0x with > 16 digits, 1e999)
+} NumberKind;
+
+typedef struct {
+    NumberKind kind;
+    union {
+        uint64_t u;
+        double f;
+    } as;
+} Number;
+
+// Parses the literal at the start of s[0..n) and returns its length in bytes,
+// 0 when kind is NUM_NONE. The caller decides whether the next byte may
+// follow a number.
+size_t number_parse(const char *s, size_t n, Number *out);
+
+#endif /* NUMBER_H */
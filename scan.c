@@ -0,0 +1,416 @@
+#include "scan.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+typedef struct {
+    const char *name;
+    size_t (*newline)(const char *s, size_t n);
+    size_t (*string_stop)(const char *s, size_t n);
+    size_t (*whitespace)(const char *s, size_t n);
+    size_t (*codepoints)(const char *s, size_t n);
+    size_t (*utf8_invalid)(const char *s, size_t n, bool *ascii);
+} ScanImpl;
+
+// ---------------------------------------------------------------------------
+// Scalar
+// ---------------------------------------------------------------------------
+
+static inline bool is_space_byte(unsigned char c) {
+    // ' ', '\t', '\n', '\v', '\f', '\r'
+    return c == ' ' || (unsigned char)(c - '\t') <= 4;
+}
+
+static size_t newline_scalar(const char *s, size_t n) {
+    size_t i = 0;
+    while (i < n && s[i] != '\n') i++;
+    return i;
+}
+
+static size_t string_stop_scalar(const char *s, size_t n) {
+    size_t i = 0;
+    while (i < n && s[i] != '"' && s[i] != '\\' && s[i] != '\n') i++;
+    return i;
+}
+
+static size_t whitespace_scalar(const char *s, size_t n) {
+    size_t i = 0;
+    while (i < n && is_space_byte((unsigned char)s[i])) i++;
+    return i;
+}
+
+static size_t codepoints_scalar(const char *s, size_t n) {
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+        count += ((unsigned char)s[i] & 0xC0) != 0x80;
+    }
+    return count;
+}
+
+// Length of the well formed sequence starting with the non ASCII byte s[0],
+// 0 when it is not one (Unicode table 3-7: no overlongs, no surrogates,
+// nothing above U+10FFFF, no truncation).
+static size_t utf8_sequence(const unsigned char *s, size_t n) {
+    unsigned char c = s[0];
+    size_t len;
+    unsigned char lo = 0x80, hi = 0xBF; // range of the second byte
+    if      (c >= 0xC2 && c <= 0xDF) len = 2;
+    else if (c == 0xE0)              len = 3, lo = 0xA0;
+    else if (c == 0xED)              len = 3, hi = 0x9F;
+    else if (c >= 0xE1 && c <= 0xEF) len = 3;
+    else if (c == 0xF0)              len = 4, lo = 0x90;
+    else if (c >= 0xF1 && c <= 0xF3) len = 4;
+    else if (c == 0xF4)              len = 4, hi = 0x8F;
+    else return 0;
+
+    if (n < len || s[1] < lo || s[1] > hi) return 0;
+    for (size_t i = 2; i < len; i++) {
+        if ((s[i] & 0xC0) != 0x80) return 0;
+    }
+    return len;
+}
+
+static size_t utf8_invalid_scalar(const char *s, size_t n, bool *ascii) {
+    const unsigned char *u = (const unsigned char *)s;
+    size_t i = 0;
+    while (i < n) {
+        if (i + 8 <= n) {
+            uint64_t w;
+            memcpy(&w, u + i, 8);
+            if (!(w & 0x8080808080808080ull)) {
+                i += 8;
+                continue;
+            }
+        }
+        if (u[i] < 0x80) {
+            i++;
+            continue;
+        }
+        *ascii = false;
+        size_t len = utf8_sequence(u + i, n - i);
+        if (!len) return i;
+        i += len;
+    }
+    return n;
+}
+
+static const ScanImpl scan_scalar = {
+    "scalar", newline_scalar, string_stop_scalar, whitespace_scalar, codepoints_scalar,
+    utf8_invalid_scalar,
+};
+
+#ifdef SCAN_X86
+
+// ---------------------------------------------------------------------------
+// SSE2, 16 bytes at a time
+// ---------------------------------------------------------------------------
+
+__attribute__((target("sse2")))
+static size_t newline_sse2(const char *s, size_t n) {
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nl));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + newline_scalar(s + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static size_t string_stop_sse2(const char *s, size_t n) {
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i bslash = _mm_set1_epi8('\\');
+    const __m128i nl = _mm_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        __m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, bslash)),
+                                   _mm_cmpeq_epi8(v, nl));
+        unsigned mask = (unsigned)_mm_movemask_epi8(hit);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + string_stop_scalar(s + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static size_t whitespace_sse2(const char *s, size_t n) {
+    const __m128i tab = _mm_set1_epi8('\t');
+    const __m128i four = _mm_set1_epi8(4);
+    const __m128i space = _mm_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        // '\t'..'\r' is (v - '\t') <= 4 unsigned
+        __m128i x = _mm_sub_epi8(v, tab);
+        __m128i ctl = _mm_cmpeq_epi8(_mm_min_epu8(x, four), x);
+        __m128i ws = _mm_or_si128(ctl, _mm_cmpeq_epi8(v, space));
+        unsigned mask = ~(unsigned)_mm_movemask_epi8(ws) & 0xFFFFu;
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + whitespace_scalar(s + i, n - i);
+}
+
+__attribute__((target("sse2")))
+static size_t codepoints_sse2(const char *s, size_t n) {
+    // continuation bytes are 0x80..0xBF, i.e. <= -65 as signed
+    const __m128i cont_max = _mm_set1_epi8((char)0xBF);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(s + i));
+        count += __builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpgt_epi8(v, cont_max)));
+    }
+    return count + codepoints_scalar(s + i, n - i);
+}
+
+// SSE2 has no byte shuffle for the lookup tables below, so it only skips
+// ASCII in bulk and checks the other sequences one by one.
+__attribute__((target("sse2")))
+static size_t utf8_invalid_sse2(const char *s, size_t n, bool *ascii) {
+    const unsigned char *u = (const unsigned char *)s;
+    size_t i = 0;
+    while (i + 16 <= n) {
+        unsigned mask = (unsigned)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+        if (!mask) {
+            i += 16;
+            continue;
+        }
+        i += __builtin_ctz(mask);
+        *ascii = false;
+        size_t len = utf8_sequence(u + i, n - i);
+        if (!len) return i;
+        i += len;
+    }
+    return i + utf8_invalid_scalar(s + i, n - i, ascii);
+}
+
+static const ScanImpl scan_sse2 = {
+    "sse2", newline_sse2, string_stop_sse2, whitespace_sse2, codepoints_sse2,
+    utf8_invalid_sse2,
+};
+
+// ---------------------------------------------------------------------------
+// AVX2, 32 bytes at a time
+// ---------------------------------------------------------------------------
+
+__attribute__((target("avx2")))
+static size_t newline_avx2(const char *s, size_t n) {
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, nl));
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + newline_sse2(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t string_stop_avx2(const char *s, size_t n) {
+    const __m256i quote = _mm256_set1_epi8('"');
+    const __m256i bslash = _mm256_set1_epi8('\\');
+    const __m256i nl = _mm256_set1_epi8('\n');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i hit = _mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(v, quote), _mm256_cmpeq_epi8(v, bslash)),
+                                      _mm256_cmpeq_epi8(v, nl));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(hit);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + string_stop_sse2(s + i, n - i);
+}
+
+__attribute__((target("avx2")))
+static size_t whitespace_avx2(const char *s, size_t n) {
+    const __m256i tab = _mm256_set1_epi8('\t');
+    const __m256i four = _mm256_set1_epi8(4);
+    const __m256i space = _mm256_set1_epi8(' ');
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i x = _mm256_sub_epi8(v, tab);
+        __m256i ctl = _mm256_cmpeq_epi8(_mm256_min_epu8(x, four), x);
+        __m256i ws = _mm256_or_si256(ctl, _mm256_cmpeq_epi8(v, space));
+        uint32_t mask = ~(uint32_t)_mm256_movemask_epi8(ws);
+        if (mask) return i + __builtin_ctz(mask);
+    }
+    return i + whitespace_sse2(s + i, n - i);
+}
+
+__attribute__((target("avx2,popcnt")))
+static size_t codepoints_avx2(const char *s, size_t n) {
+    const __m256i cont_max = _mm256_set1_epi8((char)0xBF);
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(s + i));
+        count += __builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpgt_epi8(v, cont_max)));
+    }
+    return count + codepoints_scalar(s + i, n - i);
+}
+
+// Keiser & Lemire, "Validating UTF-8 In Less Than One Instruction Per Byte".
+// Every byte is classified together with the one before it through three
+// 16 entry tables (high nibble of the previous byte, its low nibble, high
+// nibble of this byte); a bit survives the AND only for an invalid pair.
+// Continuations expected 2 and 3 bytes after a lead are checked separately.
+#define U8_TOO_SHORT  (1 << 0) // lead not followed by a continuation
+#define U8_TOO_LONG   (1 << 1) // ASCII followed by a continuation
+#define U8_OVERLONG_3 (1 << 2) // E0 80..9F
+#define U8_TOO_LARGE  (1 << 3) // F4 90..BF, F5..FF
+#define U8_SURROGATE  (1 << 4) // ED A0..BF
+#define U8_OVERLONG_2 (1 << 5) // C0, C1
+#define U8_TOO_LARGE_1000 (1 << 6) // F5..FF 80..8F
+#define U8_OVERLONG_4 (1 << 6) // F0 80..8F
+#define U8_TWO_CONTS  (1 << 7) // two continuations in a row
+#define U8_CARRY (U8_TOO_SHORT | U8_TOO_LONG | U8_TWO_CONTS)
+
+#define U8_TABLE(...) _mm256_setr_epi8(__VA_ARGS__, __VA_ARGS__)
+
+__attribute__((target("avx2")))
+static inline __m256i utf8_prev(__m256i input, __m256i prev_input, int n) {
+    __m256i joined = _mm256_permute2x128_si256(prev_input, input, 0x21);
+    switch (n) {
+    case 1:  return _mm256_alignr_epi8(input, joined, 15);
+    case 2:  return _mm256_alignr_epi8(input, joined, 14);
+    default: return _mm256_alignr_epi8(input, joined, 13);
+    }
+}
+
+__attribute__((target("avx2")))
+static inline __m256i utf8_check_block(__m256i input, __m256i prev_input) {
+    const __m256i nibble = _mm256_set1_epi8(0x0F);
+    __m256i prev1 = utf8_prev(input, prev_input, 1);
+
+    __m256i byte_1_high = _mm256_shuffle_epi8(U8_TABLE(
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG, U8_TOO_LONG,
+        U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS, U8_TWO_CONTS,
+        U8_TOO_SHORT | U8_OVERLONG_2,
+        U8_TOO_SHORT,
+        U8_TOO_SHORT | U8_OVERLONG_3 | U8_SURROGATE,
+        U8_TOO_SHORT | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_OVERLONG_4),
+        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+
+    __m256i byte_1_low = _mm256_shuffle_epi8(U8_TABLE(
+        U8_CARRY | U8_OVERLONG_3 | U8_OVERLONG_2 | U8_OVERLONG_4,
+        U8_CARRY | U8_OVERLONG_2,
+        U8_CARRY,
+        U8_CARRY,
+        U8_CARRY | U8_TOO_LARGE,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000 | U8_SURROGATE,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000,
+        U8_CARRY | U8_TOO_LARGE | U8_TOO_LARGE_1000),
+        _mm256_and_si256(prev1, nibble));
+
+    __m256i byte_2_high = _mm256_shuffle_epi8(U8_TABLE(
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE_1000 | U8_OVERLONG_4,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_OVERLONG_3 | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_LONG | U8_OVERLONG_2 | U8_TWO_CONTS | U8_SURROGATE | U8_TOO_LARGE,
+        U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT, U8_TOO_SHORT),
+        _mm256_and_si256(_mm256_srli_epi16(input, 4), nibble));
+
+    __m256i special = _mm256_and_si256(_mm256_and_si256(byte_1_high, byte_1_low), byte_2_high);
+
+    // the high bit is set where a 3rd or 4th byte of a sequence is due,
+    // which is exactly where TWO_CONTS must show up
+    __m256i third  = _mm256_subs_epu8(utf8_prev(input, prev_input, 2), _mm256_set1_epi8((char)(0xE0 - 0x80)));
+    __m256i fourth = _mm256_subs_epu8(utf8_prev(input, prev_input, 3), _mm256_set1_epi8((char)(0xF0 - 0x80)));
+    __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth), _mm256_set1_epi8((char)0x80));
+    return _mm256_xor_si256(must23, special);
+}
+
+// On an error the scalar code finds the exact spot, starting at the lead of
+// the sequence that may run into the failing block. The tail goes the same way.
+__attribute__((target("avx2")))
+static size_t utf8_invalid_avx2(const char *s, size_t n, bool *ascii) {
+    // a lead in the last 3 bytes of a block that still needs more bytes
+    const __m256i incomplete_max = _mm256_setr_epi8(
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+        (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i input = _mm256_loadu_si256((const __m256i *)(s + i));
+        __m256i error;
+        if (!_mm256_movemask_epi8(input)) {
+            error = prev_incomplete;
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            *ascii = false;
+            error = utf8_check_block(input, prev_input);
+            prev_incomplete = _mm256_subs_epu8(input, incomplete_max);
+        }
+        if (!_mm256_testz_si256(error, error)) break;
+        prev_input = input;
+    }
+
+    size_t from = i;
+    for (size_t back = 1; back <= 3 && back <= i; back++) {
+        unsigned char c = (unsigned char)s[i - back];
+        if ((c & 0xC0) == 0x80) continue;
+        if (c >= 0xC0) from = i - back;
+        break;
+    }
+    return from + utf8_invalid_scalar(s + from, n - from, ascii);
+}
+
+static const ScanImpl scan_avx2 = {
+    "avx2", newline_avx2, string_stop_avx2, whitespace_avx2, codepoints_avx2,
+    utf8_invalid_avx2,
+};
+
+#endif /* SCAN_X86 */
+
+// ---------------------------------------------------------------------------
+// Dispatch
+// ---------------------------------------------------------------------------
+
+// @NOTE: racing threads all store the same pointer, so no locking needed.
+static const ScanImpl *scan_impl = NULL;
+
+static const ScanImpl *scan_pick(void) {
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("popcnt")) return &scan_avx2;
+    if (__builtin_cpu_supports("sse2")) return &scan_sse2;
+#endif
+    return &scan_scalar;
+}
+
+static inline const ScanImpl *scan_get(void) {
+    if (!scan_impl) scan_impl = scan_pick();
+    return scan_impl;
+}
+
+size_t scan_newline(const char *s, size_t n)     { return scan_get()->newline(s, n);     }
+size_t scan_string_stop(const char *s, size_t n) { return scan_get()->string_stop(s, n); }
+size_t scan_whitespace(const char *s, size_t n)  { return scan_get()->whitespace(s, n);  }
+size_t scan_codepoints(const char *s, size_t n)  { return scan_get()->codepoints(s, n);  }
+
+size_t scan_utf8_invalid(const char *s, size_t n, bool *ascii) {
+    *ascii = true;
+    return scan_get()->utf8_invalid(s, n, ascii);
+}
+
+const char *scan_impl_name(void) { return scan_get()->name; }
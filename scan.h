@@ -0,0 +1,25 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Byte scanners used by the lexer to skip over comments, whitespace and
+// string bodies. The implementation (scalar, SSE2 or AVX2) is picked once
+// at runtime from the CPU features. None of them read past `s + n`.
+
+// Index of the first '\n', or n.
+size_t scan_newline(const char *s, size_t n);
+// Index of the first '"', '\\' or '\n', or n.
+size_t scan_string_stop(const char *s, size_t n);
+// Length of the leading run of isspace() bytes.
+size_t scan_whitespace(const char *s, size_t n);
+// Number of UTF-8 codepoints (non continuation bytes) in s[0..n).
+size_t scan_codepoints(const char *s, size_t n);
+// Index of the first byte of the first ill-formed UTF-8 sequence, or n.
+// `ascii` tells whether everything before that index was plain ASCII.
+size_t scan_utf8_invalid(const char *s, size_t n, bool *ascii);
+
+const char *scan_impl_name(void);
+
+#endif /* SCAN_H */
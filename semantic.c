@@ -1,109 +1,119 @@
 #include "semantic.h"
 #include "ast.h"
+#include "intern.h"
 
 // TODO: Dereference, addres, sizeof, function args check
 
 // Forward declarations for the recursive walkers
-static bool check_stmt(Semantic *s, Stmt *st);
-static bool check_expr(Semantic *s, Expr *e);
+static bool check_stmt(Semantic *s, StmtId id);
+static bool check_expr(Semantic *s, ExprId id);
 static bool check_type(Semantic *s, Type *t);
 
 
 // Forward declare for the pass three
-static Type *typecheck_stmt(Semantic *s, Stmt *stmt);
-static Type *typecheck_expr(Semantic *s, Expr *expr);
+static Type *typecheck_stmt(Semantic *s, StmtId id);
+static Type *typecheck_expr(Semantic *s, ExprId id);
 static bool type_equals(Type *a, Type *b);
 static bool type_can_be_promoted(Type *b, Type *a);
 static bool convert_type(Type *b, Type *a);
 
 bool semantic_check_pass_one(Semantic *s,  Statements *st) {
+    Ast *ast = s->ast;
+    s->expr_symbols = (Symbol **)arena_alloc(s->arena, ast->exprs.count * sizeof(Symbol *));
+    s->stmt_symbols = (Symbol **)arena_alloc(s->arena, ast->stmts.count * sizeof(Symbol *));
+    assert(s->expr_symbols && s->stmt_symbols && "Buy more RAM lool!!");
+    memset(s->expr_symbols, 0, ast->exprs.count * sizeof(Symbol *));
+    memset(s->stmt_symbols, 0, ast->stmts.count * sizeof(Symbol *));
+
     enter_scope(s);
     s->root_scope = s->current_scope; // Save the root scope we need this for later
 
     for (size_t i = 0; i < st->count; i++) {
-        Stmt *current = st->items[i];
+        StmtId id = st->items[i];
+        StmtNode *current = ast_stmt(ast, id);
+        SrcLoc loc = ast_stmt_loc(ast, id);
 
         // @NOTE: there is nof func stuff here because everything is registered as var with a function def inside it.
         switch (current->type) {
         case STMT_ENUM_DEF: {
             Symbol sym = {0};
-            sym.loc = current->loc;
-            sym.name = current->as.enum_def.name;
+            sym.loc = loc;
+            sym.name = ast_name(ast, current->a);
             sym.kind = SYM_TYPE;
 
             // We need to construc the enum type
             Type *newtype = make_type(s->arena, TYPE_ENUM);
-            newtype->as.enum_type.variants = &current->as.enum_def.variants;
+            newtype->as.enum_type.def = id;
             sym.declared_type = newtype;
             sym.is_extern = false; // @NOTE: maybe will support extern in the future
 
             Symbol *newsym = define_symbol(s, sym);
             if (!newsym) {
                 Symbol *before_def = lookup_symbol(s, sym.name);
-                log_error(current->loc, "Redefinition of enum %s is not allowed.",
+                log_error(loc, "Redefinition of enum %s is not allowed.",
                           sym.name);
                 log_error(before_def->loc, "enum defined here.");
                 continue;
             }
-            current->resolved_symbol = newsym;
+            s->stmt_symbols[id] = newsym;
         } break;
         case STMT_STRUCT_DEF: {
             Symbol sym = {0};
-            sym.loc = current->loc;
-            sym.name = current->as.struct_def.name;
+            sym.loc = loc;
+            sym.name = ast_name(ast, current->a);
             sym.kind = SYM_TYPE;
 
             // We need to construc the enum type
             Type *newtype = make_type(s->arena, TYPE_STRUCT);
-            newtype->as.struct_type.members = &current->as.struct_def.members;
+            newtype->as.struct_type.def = id;
             sym.declared_type = newtype;
             sym.is_extern = false; // @NOTE: maybe will support extern in the future
 
             Symbol *newsym = define_symbol(s, sym);
             if (!newsym) {
                 Symbol *before_def = lookup_symbol(s, sym.name);
-                log_error(current->loc, "Redefinition of struct %s is not allowed.",
+                log_error(loc, "Redefinition of struct %s is not allowed.",
                           sym.name);
                 log_error(before_def->loc, "struct defined here.");
                 continue;
             }
-            current->resolved_symbol = newsym;
+            s->stmt_symbols[id] = newsym;
         } break;
         case STMT_CONST: {
             Symbol sym = {0};
-            sym.loc = current->loc;
-            sym.name = current->as.const_stmt.name;
+            sym.loc = loc;
+            sym.name = ast_name(ast, current->a);
             sym.kind = SYM_CONST;
             sym.is_extern = false; // @NOTE: const cannot be an extern
-            sym.declared_type = current->as.const_stmt.type;
+            sym.declared_type = ast_type(ast, current->b);
 
             Symbol *newsym = define_symbol(s, sym);
             if (!newsym) {
                 Symbol *before_def = lookup_symbol(s, sym.name);
-                log_error(current->loc, "Redefinition of const variable %s is not allowed.",
+                log_error(loc, "Redefinition of const variable %s is not allowed.",
                           sym.name);
                 log_error(before_def->loc, "const variable defined here.");
                 continue;
             }
-            current->resolved_symbol = newsym;
+            s->stmt_symbols[id] = newsym;
         } break;
         case STMT_LET: {
             Symbol sym = {0};
-            sym.loc = current->loc;
-            sym.name = current->as.let.name;
+            sym.loc = loc;
+            sym.name = ast_name(ast, current->a);
             sym.kind = SYM_VAR;
-            sym.is_extern = current->as.let.extern_symbol;
-            sym.declared_type = current->as.let.type;
+            sym.is_extern = current->flags & STMT_FLAG_EXTERN;
+            sym.declared_type = ast_type(ast, current->b);
 
             Symbol *newsym = define_symbol(s, sym);
             if (!newsym) {
                 Symbol *before_def = lookup_symbol(s, sym.name);
-                log_error(current->loc, "Redefinition of let variable %s is not allowed.",
+                log_error(loc, "Redefinition of let variable %s is not allowed.",
                           sym.name);
                 log_error(before_def->loc, "let variable defined here.");
                 continue;
             }
-            current->resolved_symbol = newsym;
+            s->stmt_symbols[id] = newsym;
         } break;
         default: {} break;
         }
@@ -204,8 +214,10 @@ static bool check_type(Semantic *s, Type *t) {
 // Expression walker
 // ---------------------------------------------------------------------------
 
-static bool check_expr(Semantic *s, Expr *e) {
-    if (!e) return true;
+static bool check_expr(Semantic *s, ExprId id) {
+    if (!id) return true;
+    Ast *ast = s->ast;
+    ExprNode *e = ast_expr(ast, id);
     bool ok = true;
 
     switch (e->type) {
@@ -218,49 +230,43 @@ static bool check_expr(Semantic *s, Expr *e) {
 
     case EXPR_IDENTIFIER: {
         // Bind: look up the identifier in the current scope chain.
-        Symbol *sym = lookup_symbol(s, e->as.identifier);
+        Symbol *sym = lookup_symbol(s, expr_str(e));
         if (!sym) {
-            log_error(e->loc, "Undefined variable '%s'.", e->as.identifier);
+            log_error(ast_expr_loc(ast, id), "Undefined variable '%s'.", expr_str(e));
             ok = false;
         } else {
-            e->resolved_symbol = sym;
+            s->expr_symbols[id] = sym;
         }
     } break;
 
     case EXPR_UNARY_OP:
-        ok = check_expr(s, e->as.unary.right);
+        ok = check_expr(s, e->a);
         break;
 
     case EXPR_BINARY_OP:
-        ok  = check_expr(s, e->as.binary.left);
-        ok &= check_expr(s, e->as.binary.right);
-        break;
-
     case EXPR_ASSIGN:
-        ok  = check_expr(s, e->as.assign.target);
-        ok &= check_expr(s, e->as.assign.value);
-        break;
-
     case EXPR_INDEX:
-        ok  = check_expr(s, e->as.index.object);
-        ok &= check_expr(s, e->as.index.index);
+        ok  = check_expr(s, e->a);
+        ok &= check_expr(s, e->b);
         break;
 
     case EXPR_CALL: {
-        ok = check_expr(s, e->as.call.callee);
-        for (size_t i = 0; i < e->as.call.args.count; i++) {
-            if (!check_expr(s, e->as.call.args.items[i])) ok = false;
+        ok = check_expr(s, e->a);
+        uint32_t *args = ast_list_items(ast, e->b);
+        for (size_t i = 0; i < ast_list_count(ast, e->b); i++) {
+            if (!check_expr(s, args[i])) ok = false;
         }
     } break;
 
     case EXPR_FUNCTION: {
+        AstFunction *fn = ast_func(ast, e->a);
         // A function literal opens its own scope.  Parameters are registered
         // inside that scope so the body can see them.
         enter_scope(s);
 
         // Validate & register each parameter.
-        for (size_t i = 0; i < e->as.function.params.count; i++) {
-            Param *p = &e->as.function.params.items[i];
+        for (size_t i = 0; i < fn->params.count; i++) {
+            Param *p = &fn->params.items[i];
 
             if (!check_type(s, p->type)) ok = false;
 
@@ -272,18 +278,16 @@ static bool check_expr(Semantic *s, Expr *e) {
 
             Symbol *defined = define_symbol(s, sym);
             if (!defined) {
-                log_error(e->loc, "Duplicate parameter name '%s'.", p->name);
+                log_error(ast_expr_loc(ast, id), "Duplicate parameter name '%s'.", p->name);
                 ok = false;
-            } else {
-                p->resolved_symbol = defined;
             }
         }
 
         // Validate return type annotation.
-        if (!check_type(s, e->as.function.ret)) ok = false;
+        if (!check_type(s, fn->ret)) ok = false;
 
         // Walk the body (must be STMT_BLOCK, but we let check_stmt handle it).
-        if (!check_stmt(s, e->as.function.body)) ok = false;
+        if (!check_stmt(s, fn->body)) ok = false;
 
         leave_scope(s);
     } break;
@@ -296,121 +300,124 @@ static bool check_expr(Semantic *s, Expr *e) {
 // Statement walker
 // ---------------------------------------------------------------------------
 
-static bool check_stmt(Semantic *s, Stmt *st) {
-    if (!st) return true;
+static bool check_stmt(Semantic *s, StmtId id) {
+    if (!id) return true;
+    Ast *ast = s->ast;
+    StmtNode *st = ast_stmt(ast, id);
+    SrcLoc loc = ast_stmt_loc(ast, id);
     bool ok = true;
 
     switch (st->type) {
 
     case STMT_EXPR:
-        ok = check_expr(s, st->as.expr.expr);
+        ok = check_expr(s, st->a);
         break;
 
     case STMT_LET: {
         // Validate the declared type annotation.
-        if (!check_type(s, st->as.let.type)) ok = false;
+        if (!check_type(s, ast_type(ast, st->b))) ok = false;
 
         // Check the initialiser expression first (so the variable itself is
         // not yet visible on its own RHS, preventing `let x = x`).
-        if (!check_expr(s, st->as.let.value)) ok = false;
+        if (!check_expr(s, st->c)) ok = false;
 
         // At the top-level the symbol was already registered by pass one.
         // Inside nested scopes (function bodies, for-loops …) we register it
         // now so subsequent statements in the same block can see it.
         if (s->current_scope != s->root_scope) {
             Symbol sym = {0};
-            sym.loc          = st->loc;
-            sym.name         = st->as.let.name;
+            sym.loc          = loc;
+            sym.name         = ast_name(ast, st->a);
             sym.kind         = SYM_VAR;
-            sym.is_extern    = st->as.let.extern_symbol;
-            sym.declared_type = st->as.let.type;
+            sym.is_extern    = st->flags & STMT_FLAG_EXTERN;
+            sym.declared_type = ast_type(ast, st->b);
 
             Symbol *defined = define_symbol(s, sym);
             if (!defined) {
                 Symbol *before_def = lookup_symbol(s, sym.name);
-                log_error(st->loc, "Redefinition of let variable %s is not allowed.", sym.name);
+                log_error(loc, "Redefinition of let variable %s is not allowed.", sym.name);
                 log_error(before_def->loc, "let variable defined here.");
                 ok = false;
             } else {
-                st->resolved_symbol = defined;
+                s->stmt_symbols[id] = defined;
             }
         }
     } break;
 
     case STMT_CONST: {
-        if (!check_type(s, st->as.const_stmt.type)) ok = false;
-        if (!check_expr(s, st->as.const_stmt.value)) ok = false;
+        if (!check_type(s, ast_type(ast, st->b))) ok = false;
+        if (!check_expr(s, st->c)) ok = false;
 
         // Same as STMT_LET: only register inside nested scopes.
         if (s->current_scope != s->root_scope) {
             Symbol sym = {0};
-            sym.loc          = st->loc;
-            sym.name         = st->as.const_stmt.name;
+            sym.loc          = loc;
+            sym.name         = ast_name(ast, st->a);
             sym.kind         = SYM_CONST;
-            sym.declared_type = st->as.const_stmt.type;
+            sym.declared_type = ast_type(ast, st->b);
 
             Symbol *defined = define_symbol(s, sym);
             if (!defined) {
                 Symbol *before_def = lookup_symbol(s, sym.name);
-                log_error(st->loc, "Redefinition of const variable %s is not allowed.", sym.name);
+                log_error(loc, "Redefinition of const variable %s is not allowed.", sym.name);
                 log_error(before_def->loc, "const variable defined here.");
                 ok = false;
             } else {
-               st->resolved_symbol = defined;
+               s->stmt_symbols[id] = defined;
             }
         }
     } break;
 
     case STMT_RET:
-        ok = check_expr(s, st->as.expr.expr);
+        ok = check_expr(s, st->a);
         break;
 
     case STMT_IF:
-        ok  = check_expr(s, st->as.if_stmt.condition);
-        ok &= check_stmt(s, st->as.if_stmt.then_b);
-        ok &= check_stmt(s, st->as.if_stmt.else_b); // NULL-safe
+        ok  = check_expr(s, st->a);
+        ok &= check_stmt(s, st->b);
+        ok &= check_stmt(s, st->c); // AST_NONE-safe
         break;
 
     case STMT_FOR: {
         enter_scope(s);
-        st->as.for_stmt.created_scope = s->current_scope;
 
-        ok  = check_stmt(s, st->as.for_stmt.init);
-        ok &= check_expr(s, st->as.for_stmt.condition);
-        ok &= check_expr(s, st->as.for_stmt.increment);
-        ok &= check_stmt(s, st->as.for_stmt.body);
+        ok  = check_stmt(s, st->a);
+        ok &= check_expr(s, st->b);
+        ok &= check_expr(s, ast_extra(ast, st->c)[0]);
+        ok &= check_stmt(s, ast_extra(ast, st->c)[1]);
 
         leave_scope(s);
     } break;
 
     case STMT_BLOCK: {
         enter_scope(s);
-        st->as.block.created_scope = s->current_scope;
 
-        for (size_t i = 0; i < st->as.block.statements.count; i++) {
-            if (!check_stmt(s, st->as.block.statements.items[i])) ok = false;
+        uint32_t *statements = ast_list_items(ast, st->a);
+        for (size_t i = 0; i < ast_list_count(ast, st->a); i++) {
+            if (!check_stmt(s, statements[i])) ok = false;
         }
 
         leave_scope(s);
     } break;
 
     case STMT_DEFER:
-        ok = check_stmt(s, st->as.defer.callback);
+        ok = check_stmt(s, st->a);
         break;
 
     case STMT_ENUM_DEF: {
         // Check if the expression inside is valid
-        EnumVariants *var = &st->as.enum_def.variants;
-        for (size_t i = 0; i < var->count; i++) {
-            if (!check_expr(s, var->items[i].value)) ok = false;
+        uint32_t *variants = ast_extra(ast, st->b);
+        for (size_t i = 0; i < variants[0]; i++) {
+            if (!check_expr(s, variants[1 + 2 * i + 1])) ok = false;
         }
     } break;
     case STMT_STRUCT_DEF: {
         // Check if the default value and the expr of default value is valid
-        Structure *member = &st->as.struct_def.members;
-        for (size_t i = 0; i < member->count; i++) {
-            if (!check_type(s, member->items[i].type))  ok = false;
-            if (!check_expr(s, member->items[i].value)) ok = false;
+        uint32_t *members = ast_extra(ast, st->b);
+        for (size_t i = 0; i < members[0]; i++) {
+            uint32_t *member = &members[1 + 3 * i];
+            if (!check_type(s, ast_type(ast, member[1]))) ok = false;
+            if (!check_expr(s, member[2]))                ok = false;
         }
     } break;
     }
@@ -418,13 +425,14 @@ static bool check_stmt(Semantic *s, Stmt *st) {
     return ok;
 }
 
-static Type *typecheck_stmt(Semantic *s, Stmt *stmt) {
+static Type *typecheck_stmt(Semantic *s, StmtId id) {
+    StmtNode *stmt = ast_stmt(s->ast, id);
     switch (stmt->type) {
     case STMT_LET: {
         // @TODO: Resolve the type if its not typed on the let statement
         // @TODO: Check the type and check the expr type
-        Symbol *sym = stmt->resolved_symbol;
-        Type *rhs_type = typecheck_expr(s, stmt->as.let.value);
+        Symbol *sym = s->stmt_symbols[id];
+        Type *rhs_type = typecheck_expr(s, stmt->c);
 
         if (!sym) return NULL;
         if(!rhs_type) return NULL;
@@ -436,7 +444,7 @@ static Type *typecheck_stmt(Semantic *s, Stmt *stmt) {
             // @TODO: do range check if the type is annotated and the input is not the same or if its overflown then error out.
             if (!type_equals(sym->declared_type, rhs_type)) {
                 if (!type_can_be_promoted(sym->declared_type, rhs_type)) {
-                    log_error(stmt->loc, "Incompatible type on let statement `%s` and `%s`", get_type_string(sym->declared_type), get_type_string(rhs_type));
+                    log_error(ast_stmt_loc(s->ast, id), "Incompatible type on let statement `%s` and `%s`", get_type_string(sym->declared_type), get_type_string(rhs_type));
                     return NULL;
                 }
                 // @TODO: check range here (turn rhs to lhs type)
@@ -450,11 +458,11 @@ static Type *typecheck_stmt(Semantic *s, Stmt *stmt) {
     return NULL;
 }
 
-static Type *typecheck_expr(Semantic *s, Expr *expr) {
-    switch (expr->type) {
+static Type *typecheck_expr(Semantic *s, ExprId id) {
+    switch (ast_expr(s->ast, id)->type) {
     case EXPR_LITERAL_INT: {
         Type *newtype = make_type(s->arena, TYPE_BASE);
-        newtype->loc = expr->loc;
+        newtype->loc = ast_expr_loc(s->ast, id);
         // @NOTE: the default type for number is s32 like usually on C
         newtype->as.base.kind = TS32;
         newtype->as.base.name = get_basetypekind_str(newtype->as.base.kind);
@@ -521,30 +529,56 @@ void leave_scope(Semantic *s) {
     s->current_scope = s->current_scope->parent;
 }
 
+#define SYMBOLS_INITIAL_CAPACITY 8
+
+// Slot holding `interned_name`, or the empty slot where it would go.
+static Symbol **symbols_probe(Symbols *symbols, const char *interned_name, uint64_t hash) {
+    size_t mask = symbols->capacity - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        Symbol **slot = &symbols->slots[i];
+        if (*slot == NULL || (*slot)->name == interned_name) return slot;
+    }
+}
+
+static void symbols_grow(Arena *a, Symbols *symbols) {
+    size_t new_cap = symbols->capacity ? symbols->capacity * 2 : SYMBOLS_INITIAL_CAPACITY;
+    Symbol **new_slots = (Symbol **)arena_alloc(a, new_cap * sizeof(*new_slots));
+    assert(new_slots != NULL && "Buy more RAM lool!!");
+    memset(new_slots, 0, new_cap * sizeof(*new_slots));
+
+    Symbols grown = { new_slots, symbols->count, new_cap };
+    for (size_t i = 0; i < symbols->capacity; i++) {
+        Symbol *sym = symbols->slots[i];
+        if (sym != NULL) *symbols_probe(&grown, sym->name, intern_hash(sym->name)) = sym;
+    }
+    *symbols = grown;
+}
+
 Symbol *define_symbol(Semantic *s, Symbol symbol) {
     Scope *scope = s->current_scope;
+    // keep the load at or below 1/2
+    if ((scope->symbols.count + 1) * 2 > scope->symbols.capacity) symbols_grow(s->arena, &scope->symbols);
+
     // @NOTE: allow shadowing so if the symbol exist on the parent node then allow it!
     // @NOTE: i dont know if its the best idea but thats fine for now.
-    // @TODO: if this getting bigger will be replaced using hashmap.
-    for (size_t i = 0; i < scope->symbols.count; i++) {
-        Symbol current = scope->symbols.items[i];
-        if (strcmp(symbol.name, current.name) == 0) {
-            return NULL;
-        }
-    }
-    da_append(&scope->symbols, symbol);
-    return &da_last(&scope->symbols);
+    Symbol **slot = symbols_probe(&scope->symbols, symbol.name, intern_hash(symbol.name));
+    if (*slot != NULL) return NULL;
+
+    Symbol *sym = (Symbol *)arena_alloc(s->arena, sizeof(Symbol));
+    *sym = symbol;
+    *slot = sym;
+    scope->symbols.count++;
+    return sym;
 }
 
-Symbol *lookup_symbol(Semantic *s, const char *name) {
-    if (!s || !name) return NULL;
+Symbol *lookup_symbol(Semantic *s, const char *interned_name) {
+    if (!s || !interned_name) return NULL;
 
+    uint64_t hash = intern_hash(interned_name);
     for (Scope *scope = s->current_scope; scope != NULL; scope = scope->parent) {
-        for (size_t i = 0; i < scope->symbols.count; i++) {
-            if (strcmp(scope->symbols.items[i].name, name) == 0) {
-                return &scope->symbols.items[i];
-            }
-        }
+        if (scope->symbols.count == 0) continue;
+        Symbol *sym = *symbols_probe(&scope->symbols, interned_name, hash);
+        if (sym != NULL) return sym;
     }
 
     return NULL;
@@ -17,15 +17,20 @@ typedef enum {
 } Symbol_Kind;
 
 typedef struct {
-    char *name;
+    const char *name;    // interned
     Symbol_Kind kind;
     bool is_extern;      // @NOTE: only used on func
     Type *declared_type;
     SrcLoc loc;
 } Symbol;
 
+// Open addressing table keyed by the interned name. A name's hash is made
+// once when the lexer interns it, so probing costs one load for the hash
+// and pointer compares, no string is hashed or compared here.
+// @NOTE: symbols are arena allocated so the pointers handed out by
+//        define_symbol survive the table growing.
 typedef struct {
-    Symbol *items;
+    Symbol **slots;  // NULL or a symbol, capacity is a power of two
     size_t count;
     size_t capacity;
 } Symbols;
@@ -35,10 +40,15 @@ typedef struct Scope {
     struct Scope *parent;
 } Scope;
 
+// Set `arena` and `ast` before pass one. Resolution results are side tables
+// indexed by node handle, filled in by the passes.
 typedef struct {
     Arena *arena;
+    Ast *ast;
     Scope *root_scope;
     Scope *current_scope;
+    Symbol **expr_symbols; // EXPR_IDENTIFIER -> its symbol
+    Symbol **stmt_symbols; // declaration -> the symbol it defined
     Errors errors;
 } Semantic;
 
@@ -49,6 +59,6 @@ bool semantic_check_pass_three(Semantic *s, Statements *st);
 void enter_scope(Semantic *s);
 void leave_scope(Semantic *s);
 Symbol *define_symbol(Semantic *s, Symbol symbol);
-Symbol *lookup_symbol(Semantic *s, const char *name);
+Symbol *lookup_symbol(Semantic *s, const char *interned_name);
 
 #endif /* SEMANTIC_H */
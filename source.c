@@ -0,0 +1,285 @@
+#include "source.h"
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "utils.h"
+#include "scan.h"
+#include "arena.h"
+#include "intern.h"
+
+#define SOURCE_READ_CHUNK (64 * 1024)
+
+// Reserves size + 1 bytes rounded up to whole pages of zeroed anonymous
+// memory, then maps the file over the front of it. The tail of the last
+// file page is zero filled by the kernel, and if the file ends exactly on a
+// page boundary the extra anonymous page is the sentinel.
+static bool source_map(SourceFile *sf, int fd, size_t size) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    size_t map_size = (size + 1 + page - 1) & ~(page - 1);
+
+    char *base = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) return false;
+
+    if (mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        munmap(base, map_size);
+        return false;
+    }
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    sf->text.items = base;
+    sf->text.count = size + 1;
+    sf->text.capacity = 0;
+    sf->map_size = map_size;
+    return true;
+}
+
+static bool source_read(SourceFile *sf, int fd, const char *path, Arena *a) {
+    for (;;) {
+        // keep a byte for the NUL
+        if (sf->text.count + 1 >= sf->text.capacity) {
+            size_t cap = sf->text.capacity ? sf->text.capacity * 2 : SOURCE_READ_CHUNK;
+            sf->text.items = arena_realloc(a, sf->text.items, sf->text.capacity, cap);
+            assert(sf->text.items != NULL && "Buy more RAM lool!!");
+            sf->text.capacity = cap;
+        }
+        ssize_t n = read(fd, sf->text.items + sf->text.count, sf->text.capacity - sf->text.count - 1);
+        if (n == 0) break;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perr("Could not read file `%s': %s", path, strerror(errno));
+            return false;
+        }
+        sf->text.count += (size_t)n;
+    }
+    sf->text.items[sf->text.count++] = '\0';
+    return true;
+}
+
+static bool source_load(SourceFile *sf, const char *path, Arena *a) {
+    bool from_stdin = strcmp(path, "-") == 0;
+    int fd = from_stdin ? STDIN_FILENO : open(path, O_RDONLY);
+    if (fd < 0) {
+        perr("Could not open file `%s': %s", path, strerror(errno));
+        return false;
+    }
+
+    bool result = false;
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        result = source_map(sf, fd, (size_t)st.st_size);
+    }
+    if (!result) result = source_read(sf, fd, path, a);
+
+    if (!from_stdin) close(fd);
+    return result;
+}
+
+// ---------------------------------------------------------------------------
+// Source manager
+// ---------------------------------------------------------------------------
+
+typedef struct {
+    SourceFile file;    // text is only set by source_open()
+    const char *text;   // what the lexer registered last
+    size_t len;
+    uint32_t base;
+    uint32_t span;      // bytes of offset space owned, at least len + 1
+    bool ascii;         // checked by source_check_utf8(), columns are byte distances
+    struct {
+        uint32_t *items; // offset of the first byte of every line
+        size_t count;
+        size_t capacity;
+    } lines;
+} SourceEntry;
+
+// One per placement of a file in the offset space, sorted by base.
+typedef struct {
+    uint32_t base;
+    uint32_t file; // SOURCE_NONE once the file moved on
+} SourceRange;
+
+typedef struct {
+    struct {
+        SourceEntry **items; // by id, arena allocated so SourceFile pointers stay put
+        size_t count;
+        size_t capacity;
+    } files;
+    struct {
+        SourceRange *items;
+        size_t count;
+        size_t capacity;
+    } ranges;
+    uint64_t next_base;
+    Arena arena;
+} SourceManager;
+
+static SourceManager sm = {0};
+
+static Arena *source_arena(void) {
+    if (sm.arena.head == NULL && arena_init(&sm.arena, 0) != 0) {
+        perr_exit("Failed to allocate the source arena `%s`", strerror(errno));
+    }
+    return &sm.arena;
+}
+
+static SourceEntry *source_find(const char *interned_name) {
+    // newest first, a name is usually registered right after it is opened
+    for (size_t i = sm.files.count; i-- > 0;) {
+        if (sm.files.items[i]->file.name == interned_name) return sm.files.items[i];
+    }
+    return NULL;
+}
+
+static SourceEntry *source_new(const char *interned_name) {
+    SourceEntry *e = (SourceEntry *)arena_alloc(source_arena(), sizeof(*e));
+    assert(e != NULL && "Buy more RAM lool!!");
+    *e = (SourceEntry){0};
+    e->file.name = interned_name;
+    e->file.id = (uint32_t)sm.files.count;
+    da_append(&sm.files, e);
+    return e;
+}
+
+// Makes room for len + 1 bytes of offsets. The newest range just grows,
+// any other file moves to a fresh range at the end and its old range stops
+// resolving.
+static bool source_place(SourceEntry *e, size_t len) {
+    if ((size_t)e->span > len) return true;
+
+    bool newest = e->span > 0 && sm.ranges.items[sm.ranges.count - 1].file == e->file.id;
+    uint64_t base = newest ? e->base : sm.next_base;
+    if (base + len + 1 > (uint64_t)UINT32_MAX + 1) {
+        perr("`%s' does not fit, all sources together span only 4 GiB of offsets", e->file.name);
+        return false;
+    }
+
+    if (!newest) {
+        if (e->span > 0) {
+            size_t lo = 0, hi = sm.ranges.count;
+            while (hi - lo > 1) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (sm.ranges.items[mid].base <= e->base) lo = mid;
+                else                                      hi = mid;
+            }
+            sm.ranges.items[lo].file = SOURCE_NONE;
+        }
+        SourceRange r = { (uint32_t)base, e->file.id };
+        da_append(&sm.ranges, r);
+        e->base = (uint32_t)base;
+    }
+    e->span = (uint32_t)(len + 1);
+    sm.next_base = base + len + 1;
+    return true;
+}
+
+SourceFile *source_open(const char *path) {
+    const char *name = intern_cstr(path);
+    SourceEntry *e = source_find(name);
+    if (e != NULL && e->file.text.items != NULL) return &e->file;
+
+    SourceFile sf = { .name = name };
+    if (!source_load(&sf, path, source_arena())) return NULL;
+
+    if (e == NULL) e = source_new(name);
+    sf.id = e->file.id;
+    if (!source_place(e, sf.text.count)) {
+        if (sf.map_size) munmap(sf.text.items, sf.map_size);
+        return NULL;
+    }
+    e->file = sf;
+    e->text = sf.text.items;
+    e->len = sf.text.count;
+    e->lines.count = 0;
+    return &e->file;
+}
+
+uint32_t source_register(const char *name, const char *text, size_t len) {
+    const char *interned = intern_cstr(name);
+    SourceEntry *e = source_find(interned);
+    if (e == NULL) e = source_new(interned);
+    // Same text and length can still be an edit in place, so the line table
+    // is redone either way. The ascii flag stays, whoever changed bytes
+    // checks them with source_check_utf8(), which folds them into it.
+    e->lines.count = 0;
+    if (e->span > 0 && e->text == text && e->len == len) return e->file.id;
+
+    if (!source_place(e, len)) return SOURCE_NONE;
+    e->text = text;
+    e->len = len;
+    return e->file.id;
+}
+
+uint32_t source_base(uint32_t file) {
+    assert(file < sm.files.count);
+    return sm.files.items[file]->base;
+}
+
+bool source_check_utf8(uint32_t file, size_t from, size_t to) {
+    assert(file < sm.files.count);
+    SourceEntry *e = sm.files.items[file];
+    assert(from <= to && to <= e->len);
+
+    bool ascii;
+    size_t bad = from + scan_utf8_invalid(e->text + from, to - from, &ascii);
+    if (from == 0 && to == e->len) e->ascii = ascii;
+    else                           e->ascii = e->ascii && ascii;
+
+    if (bad < to) {
+        SrcLoc loc = { e->base + (uint32_t)bad };
+        log_error(loc, "invalid UTF-8 byte 0x%02X", (unsigned char)e->text[bad]);
+        return false;
+    }
+    return true;
+}
+
+// Diagnostics are rare, so the line table is only built for the first one.
+SrcPos srcloc_resolve(SrcLoc loc) {
+    // last range starting at or before the offset
+    assert(sm.ranges.count > 0);
+    size_t lo = 0, hi = sm.ranges.count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (sm.ranges.items[mid].base <= loc.offset) lo = mid;
+        else                                         hi = mid;
+    }
+    SourceRange r = sm.ranges.items[lo];
+    assert(r.file != SOURCE_NONE && "location into a file that moved, see source_register()");
+    SourceEntry *e = sm.files.items[r.file];
+    uint32_t offset = loc.offset - r.base;
+    assert(offset <= e->len);
+
+    if (e->lines.count == 0) {
+        for (size_t i = 0; i <= e->len;) {
+            arena_da_append(&sm.arena, &e->lines, (uint32_t)i);
+            i += scan_newline(e->text + i, e->len - i) + 1;
+        }
+    }
+
+    // last line starting at or before the offset
+    lo = 0, hi = e->lines.count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (e->lines.items[mid] <= offset) lo = mid;
+        else                               hi = mid;
+    }
+    uint32_t start = e->lines.items[lo];
+    size_t col = 0;
+    if (offset > start) {
+        col = e->ascii ? offset - start : scan_codepoints(e->text + start, offset - start);
+    }
+    return (SrcPos){ e->file.name, lo + 1, col + 1 };
+}
+
+void source_manager_free(void) {
+    for (size_t i = 0; i < sm.files.count; i++) {
+        SourceFile *sf = &sm.files.items[i]->file;
+        if (sf->map_size) munmap(sf->text.items, sf->map_size);
+    }
+    da_free(sm.files);
+    da_free(sm.ranges);
+    arena_deinit(&sm.arena);
+    sm = (SourceManager){0};
+}
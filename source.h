@@ -0,0 +1,56 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+#define NOB_STRIP_PREFIX
+#include "nob.h"
+
+// A loaded source file. Regular files are mmapped read-only and the byte
+// right after the file is guaranteed to be a readable NUL, so nothing gets
+// copied. Pipes, ttys and "-" (stdin) fall back to buffered reads. Either
+// way `text` holds the contents plus the trailing NUL, which is counted in
+// text.count like sb_append_null() would do.
+// @NOTE: `text` belongs to the source manager, never grow or free it
+//        yourself, copy it if you want to edit it.
+typedef struct {
+    String_Builder text;
+    size_t map_size;  // non zero when text.items is mmapped
+    const char *name; // interned
+    uint32_t id;      // from source_register()
+} SourceFile;
+
+// The source manager keeps every file the front end has seen: loaded with
+// source_open(), or only registered by the lexer. Each one gets a compact
+// id and a range of one global 32-bit offset space, len + 1 bytes long so
+// T_EOF on the sentinel has a place too. A SrcLoc is a single offset in that
+// space, srcloc_resolve() finds the file by binary search over the ranges.
+// Read buffers, line tables and the files themselves come from one arena,
+// mapped files are unmapped, all by source_manager_free().
+// @NOTE: not thread safe, load and register before handing text to threads.
+
+#define SOURCE_NONE UINT32_MAX
+
+// Loads `path` once, opening the same path again returns the same file.
+// NULL when the file can not be read (already reported).
+SourceFile *source_open(const char *path);
+
+// Every SrcLoc names its file through the range of the id returned here.
+// Registering a name again points it at the new text (after an edit) and
+// keeps the id. The caller then checks the bytes it changed, see
+// source_check_utf8(). A file that outgrows its range moves to a new one, so
+// locations made before that go stale, see source_base(). SOURCE_NONE when
+// all files together no longer fit in 4 GiB of offsets (already reported).
+// The text must stay alive as long as locations into it get printed.
+uint32_t source_register(const char *name, const char *text, size_t len);
+// Global offset of byte 0 of a registered file.
+uint32_t source_base(uint32_t file);
+// Reports the first ill-formed UTF-8 sequence in text[from, to) of a
+// registered file. `from` must start a sequence. It also keeps track of
+// whether the file is all ASCII (columns are then byte distances): the whole
+// file sets that, a range checked after an edit can only clear it.
+bool source_check_utf8(uint32_t file, size_t from, size_t to);
+void source_manager_free(void);
+
+#endif /* SOURCE_H */
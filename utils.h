@@ -6,11 +6,22 @@
 #include <assert.h>
 #include <time.h>
 
+#include <stdint.h>
+
+// A location is an offset in the source manager's global offset space
+// (see source.h), the base of its file plus the byte offset in it. It only
+// becomes file:line:col through srcloc_resolve() when it gets printed.
+typedef struct {
+    uint32_t offset;
+} SrcLoc;
+
 typedef struct {
     const char *name;
     size_t line;
     size_t col;
-} SrcLoc;
+} SrcPos;
+
+SrcPos srcloc_resolve(SrcLoc loc); // source.c
 
 typedef struct {
     char **items;
@@ -21,7 +32,7 @@ typedef struct {
 #define CTCHK "comptimecheck"
 
 #define log_error(loc, fmt, ...) \
-    do { fprintf(stderr, "%s:%lu:%lu: error: " fmt "\n", loc.name, loc.line, loc.col, ##__VA_ARGS__); } while(0)
+    do { SrcPos pos_ = srcloc_resolve(loc); fprintf(stderr, "%s:%lu:%lu: error: " fmt "\n", pos_.name, pos_.line, pos_.col, ##__VA_ARGS__); } while(0)
 
 #define perr_exit(fmt, ...)\
     do { fprintf(stderr, "ERROR: " fmt "\n", ##__VA_ARGS__); exit(1); } while(0)